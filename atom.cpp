@@ -0,0 +1,111 @@
+#include "atom.hpp"
+
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace tonal;
+
+namespace {
+/**
+ * Spellings are copied into an arena and indexed by atom in fixed blocks
+ * that never move, so spelling() reads them without taking the lock. An atom
+ * is only ever learned through intern(), whose lock publishes its block.
+ */
+class AtomTable {
+public:
+  AtomTable() { add({}); }
+
+  Atom intern(string_view text) {
+    {
+      shared_lock lock{mutex};
+      if (auto atom = atoms.find(text); atom != atoms.end())
+        return atom->second;
+    }
+    unique_lock lock{mutex};
+    if (auto atom = atoms.find(text); atom != atoms.end())
+      return atom->second;
+    return add(text);
+  }
+
+  string_view spelling(Atom atom) const {
+    return blocks[atom / block_size][atom % block_size];
+  }
+
+  size_t size() const {
+    shared_lock lock{mutex};
+    return count;
+  }
+
+private:
+  static constexpr size_t block_size = 4096, max_blocks = 1 << 16;
+  static constexpr size_t chunk_size = 1 << 16;
+
+  Atom add(string_view text) {
+    if (count == block_size * max_blocks)
+      throw length_error{"Too many atoms"};
+    auto &block = blocks[count / block_size];
+    if (!block)
+      block = make_unique<string_view[]>(block_size);
+    auto stored = store(text);
+    block[count % block_size] = stored;
+    atoms.emplace(stored, count);
+    return count++;
+  }
+
+  string_view store(string_view text) {
+    if (text.empty())
+      return {};
+    if (text.size() > chunk_size / 4) {
+      chunks.push_back(make_unique<char[]>(text.size()));
+      text.copy(chunks.back().get(), text.size());
+      return {chunks.back().get(), text.size()};
+    }
+    if (text.size() > chunk_left) {
+      chunks.push_back(make_unique<char[]>(chunk_size));
+      chunk_next = chunks.back().get();
+      chunk_left = chunk_size;
+    }
+    string_view stored{chunk_next, text.copy(chunk_next, text.size())};
+    chunk_next += text.size();
+    chunk_left -= text.size();
+    return stored;
+  }
+
+  mutable shared_mutex mutex;
+  unordered_map<string_view, Atom> atoms;
+  unique_ptr<string_view[]> blocks[max_blocks];
+  vector<unique_ptr<char[]>> chunks;
+  char *chunk_next = nullptr;
+  size_t chunk_left = 0;
+  Atom count = 0;
+};
+
+AtomTable &atom_table() {
+  static AtomTable table;
+  return table;
+}
+} // namespace
+
+/**
+ * Each thread remembers the atoms it has seen, so lexing a file with many
+ * repeated names takes the shared lock once per distinct name.
+ */
+Atom tonal::intern(string_view text) {
+  thread_local unordered_map<string_view, Atom> seen;
+  if (auto atom = seen.find(text); atom != seen.end())
+    return atom->second;
+  auto atom = atom_table().intern(text);
+  seen.emplace(spelling(atom), atom);
+  return atom;
+}
+
+string_view tonal::spelling(Atom atom) {
+  return atom_table().spelling(atom);
+}
+
+size_t tonal::atom_count() { return atom_table().size(); }
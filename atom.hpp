@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Dense id of an interned string. Within a process equal strings have equal
+ * atoms, so names compare and hash as integers. Atom 0 is the empty string.
+ * Atoms are handed out in first-seen order and are not stable across runs.
+ */
+using Atom = uint32_t;
+
+/**
+ * The atom of text, interning it the first time it is seen. Safe to call
+ * concurrently.
+ */
+Atom intern(string_view text);
+
+/**
+ * The interned text of an atom. It stays valid until the process exits.
+ */
+string_view spelling(Atom atom);
+
+/**
+ * Number of atoms interned so far.
+ */
+size_t atom_count();
+} // namespace tonal
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+namespace tonal::bench {
+using namespace std;
+
+/**
+ * Best of a few runs of f, in milliseconds, so one slow run from a cold
+ * cache or a busy machine does not count.
+ */
+template <typename F> double milliseconds(F &&f, int runs = 3) {
+  auto best = 1e300;
+  for (int i = 0; i < runs; ++i) {
+    const auto start = chrono::steady_clock::now();
+    f();
+    const chrono::duration<double, milli> taken =
+        chrono::steady_clock::now() - start;
+    best = min(best, taken.count());
+  }
+  return best;
+}
+
+/**
+ * The contents of a file, which must exist: benchmarks run from the top of
+ * the tree.
+ */
+inline string slurp(const string &path) {
+  ifstream in{path, ios::binary};
+  if (!in)
+    throw runtime_error{"Cannot read " + path + "; run from the top"};
+  ostringstream out;
+  out << in.rdbuf();
+  return out.str();
+}
+
+/**
+ * Keeps a value the optimizer would otherwise see is unused.
+ */
+template <typename T> void keep(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+} // namespace tonal::bench
@@ -0,0 +1,49 @@
+#include "../cache.hpp"
+#include "../token.hpp"
+#include "bench.hpp"
+
+#include <experimental/filesystem>
+#include <iostream>
+
+using namespace tonal;
+using namespace tonal::bench;
+namespace fs = experimental::filesystem;
+
+/**
+ * A cold build lexes a source and stores its tokens; a warm one finds the
+ * entry, compares the source and reads the tokens back. The source is
+ * lang.decl repeated to a few MiB, in a cache directory of its own.
+ */
+int main() {
+  const auto prelude = slurp("lang.decl");
+  string source;
+  while (source.size() < (4 << 20))
+    source += prelude;
+
+  const auto directory = fs::temp_directory_path() / "tonal-bench-cache";
+  fs::remove_all(directory);
+  const TokenCache cache{directory.u8string()};
+
+  size_t stored = 0, read = 0;
+  const auto cold = milliseconds([&] {
+    const TokenStore tokens{source};
+    string payload;
+    tokens.write(payload);
+    cache.store(source, payload);
+    stored = tokens.size();
+  });
+  const auto warm = milliseconds([&] {
+    TokenStore tokens;
+    if (!cache.find(source, [&](string_view data) {
+          return tokens.read(source, data);
+        }))
+      throw runtime_error{"The cache missed what was just stored"};
+    read = tokens.size();
+  });
+  fs::remove_all(directory);
+  if (read != stored)
+    throw runtime_error{"The cache read back other tokens"};
+
+  cout << "cache: " << source.size() / 1024 << " KiB, " << stored
+       << " tokens: cold " << cold << " ms, warm " << warm << " ms\n";
+}
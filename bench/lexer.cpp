@@ -0,0 +1,127 @@
+#include "../token.hpp"
+#include "bench.hpp"
+
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+
+using namespace tonal;
+using namespace tonal::bench;
+
+namespace {
+/**
+ * The table-driven scanner against the std::regex lexer it replaced, on
+ * lang.decl repeated, checking both split the source alike.
+ */
+void scanner_against_regex(const string &prelude) {
+  string source;
+  for (int i = 0; i < 100; ++i)
+    source += prelude;
+
+  vector<Token> scanned, matched;
+  const auto scanner = milliseconds(
+      [&] { scanned = tokenize(source, Lexer::SCANNER, 1); });
+  const auto regex =
+      milliseconds([&] { matched = tokenize(source, Lexer::REGEX, 1); }, 1);
+  if (scanned.size() != matched.size() ||
+      !equal(begin(scanned), end(scanned), begin(matched),
+             [](auto &l, auto &r) { return l.region == r.region; }))
+    throw runtime_error{"The scanner and the regex lexer disagree"};
+
+  cout << "lexer: " << source.size() / 1024 << " KiB, " << scanned.size()
+       << " tokens: scanner " << scanner << " ms, regex " << regex
+       << " ms\n";
+}
+
+/**
+ * A token store of lang.decl repeated to a few MiB, lexed in chunks on one
+ * thread per core against all on one, checking both store the same tokens.
+ */
+void chunked_store(const string &prelude) {
+  string source;
+  while (source.size() < (4 << 20))
+    source += prelude;
+
+  string one, all;
+  const auto single = milliseconds([&] {
+    one.clear();
+    TokenStore{source, false, 1}.write(one);
+  });
+  const auto threads = max(thread::hardware_concurrency(), 1u);
+  const auto chunked = milliseconds([&] {
+    all.clear();
+    TokenStore{source, false, threads}.write(all);
+  });
+  if (one != all)
+    throw runtime_error{"Chunked lexing stored other tokens"};
+
+  cout << "token store: " << source.size() / 1024 << " KiB: one thread "
+       << single << " ms, chunked for " << threads << " cores " << chunked
+       << " ms\n";
+}
+
+/**
+ * Lexing one long line of lists, at doubling lengths. The time per byte
+ * stays flat if working out columns is linear in the line.
+ */
+void long_lines() {
+  for (size_t kib = 256; kib <= 4096; kib *= 2) {
+    string line;
+    while (line.size() < kib * 1024)
+      line += "(a b.c 12 \"s\") ";
+    const auto taken = milliseconds([&] {
+      int64_t columns = 0;
+      for (auto &&token : TokenStream{line})
+        columns += token.column;
+      keep(columns);
+    });
+    cout << "long line: " << kib << " KiB in " << taken << " ms, "
+         << taken * 1e6 / line.size() << " ns per byte\n";
+  }
+}
+
+/**
+ * Keyword lookups on every word of lang.decl repeated 1000 times: the
+ * compile-time perfect hash against an unordered_map of the same keywords,
+ * as the lexer used before.
+ */
+void keywords(const string &prelude) {
+  vector<string_view> words;
+  unordered_map<string_view, Keyword> map;
+  const auto tokens = tokenize(prelude);
+  for (auto &token : tokens)
+    if (holds_alternative<Token::Keyword>(token.detail) ||
+        holds_alternative<Token::Identifier>(token.detail)) {
+      words.push_back(token.region);
+      if (auto keyword = find_keyword(token.region))
+        map.emplace(token.region, *keyword);
+    }
+
+  const auto lookups = words.size() * 1000;
+  const auto hashed = milliseconds([&] {
+    size_t found = 0;
+    for (int i = 0; i < 1000; ++i)
+      for (auto word : words)
+        found += find_keyword(word).has_value();
+    keep(found);
+  });
+  const auto mapped = milliseconds([&] {
+    size_t found = 0;
+    for (int i = 0; i < 1000; ++i)
+      for (auto word : words)
+        found += map.count(word);
+    keep(found);
+  });
+  cout << "keywords: " << lookups << " lookups: perfect hash "
+       << hashed * 1e6 / lookups << " ns, map " << mapped * 1e6 / lookups
+       << " ns each\n";
+}
+} // namespace
+
+int main() {
+  const auto prelude = slurp("lang.decl");
+  scanner_against_regex(prelude);
+  chunked_store(prelude);
+  long_lines();
+  keywords(prelude);
+}
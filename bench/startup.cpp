@@ -0,0 +1,37 @@
+#include "bench.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+using namespace tonal::bench;
+
+namespace {
+/**
+ * Milliseconds per run of a command, with its output thrown away.
+ */
+double per_run(const string &command, int runs) {
+  const auto silenced = command + " > /dev/null";
+  return milliseconds([&] {
+           for (int i = 0; i < runs; ++i)
+             if (system(silenced.c_str()))
+               throw runtime_error{"Failed: " + command};
+         }) /
+         runs;
+}
+} // namespace
+
+/**
+ * Process startup on a file that declares nothing: tonal with the prelude
+ * built in, against tonal-bootstrap lexing and parsing lang.decl first as
+ * tonal did before, and against tonal-bootstrap with no prelude at all.
+ */
+int main() {
+  constexpr int runs = 100;
+  const auto built_in = per_run("./tonal -c bench/startup.decl", runs);
+  const auto parsed =
+      per_run("./tonal-bootstrap -c lang.decl bench/startup.decl", runs);
+  const auto none = per_run("./tonal-bootstrap -c bench/startup.decl", runs);
+
+  cout << "startup: prelude built in " << built_in << " ms, parsed "
+       << parsed << " ms, none " << none << " ms per run\n";
+}
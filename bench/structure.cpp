@@ -0,0 +1,89 @@
+#define main tonal_main
+#include "../tonal.cpp"
+#undef main
+
+#include "bench.hpp"
+
+using namespace tonal::bench;
+
+namespace {
+/**
+ * Lists nested depth deep, each holding width atoms before the next level,
+ * repeated forms times at top level.
+ */
+string nested(int forms, int depth, int width) {
+  string source;
+  for (int form = 0; form < forms; ++form) {
+    for (int level = 0; level < depth; ++level) {
+      source += "(f";
+      for (int i = 0; i < width; ++i)
+        source += " a" + to_string(i);
+      source += ' ';
+    }
+    source += string(depth, ')') + '\n';
+  }
+  return source;
+}
+
+/**
+ * How compile() found tails before the index: searching forward from each
+ * head for the first close at the head's indent.
+ */
+vector<TokenHandle> search_tails(const TokenStore &tokens) {
+  vector<TokenHandle> tails;
+  for (TokenHandle head = 0; head < tokens.size(); ++head) {
+    if (tokens.type(head) != TokenType::LIST || tokens.list(head).end)
+      continue;
+    TokenHandle tail = head + 1;
+    while (tail < tokens.size() &&
+           !(tokens.type(tail) == TokenType::LIST && tokens.list(tail).end &&
+             tokens.indent(tail) == tokens.indent(head)))
+      ++tail;
+    tails.push_back(tail);
+  }
+  return tails;
+}
+
+/**
+ * Indexing the lists of a generated source against searching for their
+ * tails, then visiting every element of every list through the index.
+ */
+void structure(const string &name, const string &source) {
+  const TokenStore tokens{source};
+  vector<List> lists;
+  vector<ListHandle> owners;
+  vector<TokenHandle> searched;
+  const auto indexed =
+      milliseconds([&] { ParseState::index_lists(tokens, lists, owners); });
+  const auto search =
+      milliseconds([&] { searched = search_tails(tokens); }, 1);
+  if (searched.size() != lists.size() ||
+      !equal(begin(searched), end(searched), begin(lists),
+             [](auto tail, auto &list) { return tail == list.tail; }))
+    throw runtime_error{"The index and the search found other tails"};
+
+  const auto size = tokens.size();
+  ostringstream diagnostics;
+  const ParseState state{name, TokenStore{source}, move(lists), move(owners),
+                         diagnostics};
+  size_t elements = 0;
+  const auto iterated = milliseconds([&] {
+    elements = 0;
+    for (ListHandle list = 0; list < state.lists.size(); ++list)
+      for (auto i = state.iterate_list(list); !i.at_tail(); ++i)
+        ++elements;
+    keep(elements);
+  });
+
+  cout << name << ": " << size << " tokens, " << state.lists.size()
+       << " lists: index " << indexed * 1e6 / size << " ns per token, search "
+       << search * 1e6 / size << " ns per token; " << elements
+       << " elements iterated in " << iterated << " ms\n";
+}
+} // namespace
+
+int main() {
+  structure("deep", nested(1, 5000, 1));
+  structure("wide", nested(200000, 1, 2));
+  structure("mixed", nested(200, 200, 50));
+}
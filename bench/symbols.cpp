@@ -0,0 +1,85 @@
+#include "../symboltable.hpp"
+#include "bench.hpp"
+
+#include <iostream>
+#include <random>
+#include <unordered_map>
+
+using namespace tonal;
+using namespace tonal::bench;
+
+/**
+ * Lookups of random names across 64 nested scopes of 200 names with three
+ * overloads each: the scoped table against an unordered_multimap of names
+ * per scope, as the table was before. A lookup walks 32 levels on average
+ * before the scope declaring its name.
+ */
+int main() {
+  constexpr int levels = 64, names = 200, overloads = 3;
+  constexpr size_t lookups = 4'000'000;
+
+  vector<string> spellings;
+  for (int level = 0; level < levels; ++level)
+    for (int name = 0; name < names; ++name)
+      spellings.push_back("n" + to_string(level) + '_' + to_string(name));
+  vector<Atom> atoms;
+  for (auto &spelling : spellings)
+    atoms.push_back(intern(spelling));
+
+  SymbolTable<int> table;
+  vector<unordered_multimap<string_view, int>> maps;
+  const auto built = milliseconds(
+      [&] {
+        for (int level = 0; level < levels; ++level) {
+          table.push_scope();
+          for (int name = 0; name < names; ++name)
+            for (int overload = 0; overload < overloads; ++overload)
+              table.insert(atoms[level * names + name], overload);
+        }
+      },
+      1);
+  const auto built_maps = milliseconds(
+      [&] {
+        for (int level = 0; level < levels; ++level) {
+          auto &map = maps.emplace_back();
+          for (int name = 0; name < names; ++name)
+            for (int overload = 0; overload < overloads; ++overload)
+              map.emplace(spellings[level * names + name], overload);
+        }
+      },
+      1);
+
+  mt19937 random{42};
+  uniform_int_distribution<size_t> pick{0, atoms.size() - 1};
+  vector<size_t> picked(lookups);
+  for (auto &p : picked)
+    p = pick(random);
+
+  size_t found = 0, found_maps = 0;
+  const auto probed = milliseconds([&] {
+    found = 0;
+    for (auto p : picked)
+      found += table.find(atoms[p]).size();
+    keep(found);
+  });
+  const auto searched = milliseconds(
+      [&] {
+        found_maps = 0;
+        for (auto p : picked)
+          for (auto level = maps.size(); level-- > 0;)
+            if (auto [first, last] = maps[level].equal_range(spellings[p]);
+                first != last) {
+              found_maps += distance(first, last);
+              break;
+            }
+        keep(found_maps);
+      },
+      1);
+  if (found != found_maps || found != lookups * overloads)
+    throw runtime_error{"The table and the maps found other entries"};
+
+  cout << "symbols: " << table.size() << " entries in " << levels
+       << " scopes: build " << built << " ms, maps " << built_maps << " ms; "
+       << lookups << " lookups " << probed << " ms, maps " << searched
+       << " ms\n";
+}
@@ -0,0 +1,140 @@
+#define main tonal_main
+#include "../tonal.cpp"
+#undef main
+
+#include "bench.hpp"
+
+using namespace tonal::bench;
+
+namespace {
+/**
+ * A naive interpreter of the same bodies: each form is walked as it was
+ * reified, operators are told apart by spelling, and every call gets a
+ * hash map of locals. It knows only the forms bench/vm.decl uses.
+ */
+class Walker {
+public:
+  explicit Walker(vector<VirtualMachine::Body> bodies)
+      : bodies(move(bodies)) {}
+
+  int64_t call(Atom name, const vector<int64_t> &arguments) {
+    const auto body =
+        find_if(begin(bodies), end(bodies),
+                [name](auto &candidate) { return candidate.name == name; });
+    return call(*body, arguments);
+  }
+
+private:
+  using Locals = unordered_map<Atom, int64_t>;
+
+  int64_t call(const VirtualMachine::Body &body,
+               const vector<int64_t> &arguments) {
+    Locals locals;
+    for (size_t i = 0; i < arguments.size(); ++i)
+      locals[body.parameters[i]] = arguments[i];
+    int64_t value = 0;
+    for (auto form : body.forms)
+      value = eval(body, form, locals);
+    return value;
+  }
+
+  int64_t eval(const VirtualMachine::Body &body, Reification form,
+               Locals &locals) {
+    const auto [entity, arity, arguments] = instantiation(form);
+    if (!arity) {
+      if (auto local = locals.find(entity); local != end(locals))
+        return local->second;
+      return *VirtualMachine::number(entity);
+    }
+
+    const auto at = [&](uint32_t i) {
+      return eval(body, arguments[i], locals);
+    };
+    const auto op = spelling(entity);
+    if (op == "+" || op == "-" || op == "*" || op == "%") {
+      auto value = at(0);
+      for (uint32_t i = 1; i < arity; ++i)
+        value = op == "+"   ? value + at(i)
+                : op == "-" ? value - at(i)
+                : op == "*" ? value * at(i)
+                            : value % at(i);
+      return value;
+    }
+    if (op == "<")
+      return at(0) < at(1);
+    if (op == "=")
+      return locals[instantiation(arguments[0]).entity] = at(1);
+    if (op == "if")
+      return at(0) ? at(1) : arity > 2 ? at(2) : 0;
+    if (op == "while") {
+      while (at(0))
+        for (uint32_t i = 1; i < arity; ++i)
+          at(i);
+      return 0;
+    }
+    if (op == "do") {
+      int64_t value = 0;
+      for (uint32_t i = 0; i < arity; ++i)
+        value = at(i);
+      return value;
+    }
+
+    vector<int64_t> values;
+    for (uint32_t i = 0; i < arity; ++i)
+      values.push_back(at(i));
+    return call(bodies[body.calls.at(form)], values);
+  }
+
+  vector<VirtualMachine::Body> bodies;
+};
+
+/**
+ * One call on the machine against the same call on the walker, checking
+ * both return the same.
+ */
+void compare(VirtualMachine &vm, Walker &walker, const string &name,
+             int64_t argument) {
+  int64_t ran = 0, walked = 0;
+  const auto on_vm =
+      milliseconds([&] { ran = vm.call(intern(name), {argument}); });
+  const auto on_walker =
+      milliseconds([&] { walked = walker.call(intern(name), {argument}); });
+  if (ran != walked)
+    throw runtime_error{"The machine and the walker disagree on " + name};
+
+  cout << "vm: " << name << ' ' << argument << " = " << ran << ": machine "
+       << on_vm << " ms, tree walker " << on_walker << " ms\n";
+}
+} // namespace
+
+/**
+ * Runs the call- and loop-heavy functions of bench/vm.decl on the bytecode
+ * machine and on a tree walker, and resumes a generator a million times.
+ */
+int main() {
+  const filesystem::path file = "bench/vm.decl";
+  ParseState::load_prelude();
+  ostringstream diagnostics;
+  ParseState::compile(file, diagnostics);
+  const auto bodies = ParseState::states.find(canonical(absolute(file)))
+                          ->bodies();
+
+  VirtualMachine vm{bodies};
+  Walker walker{bodies};
+  compare(vm, walker, "fib", 25);
+  compare(vm, walker, "sum", 1'000'000);
+
+  constexpr int64_t resumes = 1'000'000;
+  int64_t total = 0;
+  const auto resumed = milliseconds([&] {
+    total = 0;
+    auto generator = vm.start(intern("countdown"), {resumes});
+    while (auto value = generator.resume())
+      total += *value;
+  });
+  if (total != resumes * (resumes + 1) / 2)
+    throw runtime_error{"The generator yielded other values"};
+
+  cout << "vm: " << resumes << " resumes in " << resumed << " ms, "
+       << resumed * 1e6 / resumes << " ns each\n";
+}
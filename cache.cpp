@@ -0,0 +1,75 @@
+#include "cache.hpp"
+#include "token.hpp"
+
+#include <cstdio>
+#include <experimental/filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <thread>
+
+using namespace tonal;
+using namespace experimental;
+
+static constexpr char magic[8] = {'t', 'o', 'n', 'a', 'l', 't', 'o', 'k'};
+
+TokenCache::TokenCache(string directory) : directory(move(directory)) {}
+
+string TokenCache::entry_path(uint64_t hash) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx-%u.tok",
+           static_cast<unsigned long long>(hash), lexer_version);
+  return (filesystem::path{directory} / name).u8string();
+}
+
+bool TokenCache::check(const Header &header, uint64_t hash, uint64_t size) {
+  return equal(begin(magic), end(magic), header.magic) &&
+         header.version == lexer_version && header.hash == hash &&
+         header.size == size;
+}
+
+/**
+ * 64-bit FNV-1a.
+ */
+uint64_t TokenCache::content_hash(string_view source) {
+  uint64_t hash = 14695981039346656037ull;
+  for (auto c : source)
+    hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ull;
+  return hash;
+}
+
+/**
+ * The cache is only an accelerator, so failing to write it is not an error.
+ */
+void TokenCache::store(string_view source, string_view payload) const {
+  if (!enabled())
+    return;
+
+  Header header{};
+  copy(begin(magic), end(magic), header.magic);
+  header.version = lexer_version;
+  header.hash = content_hash(source);
+  header.size = source.size();
+
+  error_code error;
+  filesystem::create_directories(directory, error);
+  auto path = entry_path(header.hash);
+  auto temporary =
+      path + '.' +
+      to_string(hash<thread::id>{}(this_thread::get_id()) ^ random_device{}()) +
+      ".tmp";
+  {
+    ofstream out{temporary, ios::binary | ios::trunc};
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    out.write(source.data(), source.size());
+    out.write("\0\0\0\0\0\0\0", padded(source.size()) - source.size());
+    out.write(payload.data(), payload.size());
+    if (!out.flush()) {
+      out.close();
+      remove(temporary.c_str());
+      return;
+    }
+  }
+  if (rename(temporary.c_str(), path.c_str()))
+    remove(temporary.c_str());
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "source.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Arrays are stored as a 64-bit element count followed by the raw elements,
+ * padded to 8 bytes so that the next array stays aligned in a mapping.
+ */
+template <typename T> void write_array(string &out, const vector<T> &array) {
+  static_assert(is_trivially_copyable_v<T>);
+  uint64_t count = array.size();
+  out.append(reinterpret_cast<const char *>(&count), sizeof(count));
+  out.append(reinterpret_cast<const char *>(array.data()),
+             count * sizeof(T));
+  out.append((8 - out.size() % 8) % 8, '\0');
+}
+
+/**
+ * Reads an array written by write_array from the front of in, consuming it.
+ * Returns false if in is too short.
+ */
+template <typename T> bool read_array(string_view &in, vector<T> &array) {
+  static_assert(is_trivially_copyable_v<T>);
+  uint64_t count;
+  if (in.size() < sizeof(count))
+    return false;
+  memcpy(&count, in.data(), sizeof(count));
+  in.remove_prefix(sizeof(count));
+  if (count > in.size() / sizeof(T))
+    return false;
+  size_t size = count * sizeof(T);
+  array.resize(count);
+  memcpy(array.data(), in.data(), size);
+  in.remove_prefix(min(in.size(), size + (8 - size % 8) % 8));
+  return true;
+}
+
+/**
+ * Directory of lexed token streams, one file per source content hash and
+ * lexer version. Entries are written to a temporary file and renamed into
+ * place, so builds sharing a directory never see a partial entry. An entry
+ * keeps a copy of its source, compared in full before the entry is used, so
+ * sources whose hashes collide miss rather than share tokens.
+ */
+class TokenCache {
+public:
+  /**
+   * Caching is off if directory is empty.
+   */
+  explicit TokenCache(string directory = {});
+
+  bool enabled() const { return !directory.empty(); }
+
+  /**
+   * Calls read with the payload cached for source and returns its result, or
+   * false on a miss. The payload is only valid during the call.
+   */
+  template <typename Read> bool find(string_view source, Read &&read) const;
+
+  void store(string_view source, string_view payload) const;
+
+private:
+  string entry_path(uint64_t hash) const;
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t hash;
+    uint64_t size;
+  };
+
+  static bool check(const Header &header, uint64_t hash, uint64_t size);
+  static uint64_t content_hash(string_view source);
+  static size_t padded(size_t size) { return (size + 7) / 8 * 8; }
+
+  string directory;
+};
+} // namespace tonal
+
+template <typename Read>
+bool tonal::TokenCache::find(string_view source, Read &&read) const {
+  if (!enabled())
+    return false;
+  auto hash = content_hash(source);
+  Source entry{entry_path(hash)};
+  auto text = entry.text();
+  Header header;
+  if (text.size() < sizeof(header))
+    return false;
+  memcpy(&header, text.data(), sizeof(header));
+  if (!check(header, hash, source.size()))
+    return false;
+  text.remove_prefix(sizeof(header));
+  if (text.size() < padded(source.size()) ||
+      text.compare(0, source.size(), source))
+    return false;
+  text.remove_prefix(padded(source.size()));
+  return read(text);
+}
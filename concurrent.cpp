@@ -0,0 +1,96 @@
+#include "concurrent.hpp"
+
+using namespace tonal;
+
+static thread_local const WorkStealingPool *current_pool = nullptr;
+static thread_local size_t current_worker = 0;
+
+WorkStealingPool::WorkStealingPool(unsigned threads) {
+  if (!threads)
+    threads = max(1u, thread::hardware_concurrency());
+  for (unsigned i = 0; i < threads; ++i)
+    workers.push_back(make_unique<Worker>());
+  for (unsigned i = 0; i < threads; ++i)
+    this->threads.emplace_back([this, i] { run(i); });
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  wait();
+  {
+    lock_guard lock{state};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &thread : threads)
+    thread.join();
+}
+
+void WorkStealingPool::submit(function<void()> task) {
+  const auto self =
+      current_pool == this ? current_worker : next++ % workers.size();
+  ++pending;
+  {
+    lock_guard lock{workers[self]->lock};
+    workers[self]->tasks.push_back(move(task));
+    ++queued;
+  }
+  /**
+   * Taking state orders the change before the wait of a worker that saw
+   * nothing queued, so the notification cannot fall in between.
+   */
+  {
+    lock_guard lock{state};
+  }
+  wake.notify_one();
+}
+
+void WorkStealingPool::wait() {
+  unique_lock lock{state};
+  done.wait(lock, [this] { return !pending; });
+}
+
+bool WorkStealingPool::pop(size_t self, function<void()> &task) {
+  for (size_t i = 0; i < workers.size(); ++i) {
+    auto &worker = *workers[(self + i) % workers.size()];
+    lock_guard lock{worker.lock};
+    if (worker.tasks.empty())
+      continue;
+    if (i) {
+      task = move(worker.tasks.front());
+      worker.tasks.pop_front();
+    } else {
+      task = move(worker.tasks.back());
+      worker.tasks.pop_back();
+    }
+    --queued;
+    return true;
+  }
+  return false;
+}
+
+void WorkStealingPool::run(size_t self) {
+  current_pool = this;
+  current_worker = self;
+  for (function<void()> task;;) {
+    if (pop(self, task)) {
+      task();
+      task = nullptr;
+      if (!--pending) {
+        {
+          lock_guard lock{state};
+        }
+        done.notify_all();
+      }
+      continue;
+    }
+
+    /**
+     * queued only counts tasks in a deque, so a worker that wakes to it
+     * finds one unless another worker takes it first.
+     */
+    unique_lock lock{state};
+    wake.wait(lock, [this] { return stopping || queued; });
+    if (stopping && !queued)
+      return;
+  }
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Ordered map safe to use from many threads. Entries are never replaced once
+ * inserted, so values handed out stay valid.
+ */
+template <typename Key, typename Value> class ConcurrentMap {
+public:
+  /**
+   * Inserts the value unless the key is already present. Returns whether it
+   * was inserted.
+   */
+  bool insert(const Key &key, Value value) {
+    unique_lock lock{mutex};
+    return entries.emplace(key, move(value)).second;
+  }
+
+  /**
+   * The value for the key, or a default one if absent.
+   */
+  Value find(const Key &key) const {
+    shared_lock lock{mutex};
+    auto entry = entries.find(key);
+    return entry == entries.end() ? Value{} : entry->second;
+  }
+
+  size_t size() const {
+    shared_lock lock{mutex};
+    return entries.size();
+  }
+
+  /**
+   * Visits entries in key order. The map must not be written to from f.
+   */
+  template <typename F> void for_each(F &&f) const {
+    shared_lock lock{mutex};
+    for (auto &entry : entries)
+      f(entry.first, entry.second);
+  }
+
+private:
+  mutable shared_mutex mutex;
+  map<Key, Value> entries;
+};
+
+/**
+ * Fixed set of threads, each with its own task deque. A worker runs its own
+ * newest task first and, when out of work, steals the oldest task of another.
+ * Tasks may submit more tasks but must not throw.
+ */
+class WorkStealingPool {
+public:
+  /**
+   * One thread per core if zero.
+   */
+  explicit WorkStealingPool(unsigned threads = 0);
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+  ~WorkStealingPool();
+
+  void submit(function<void()> task);
+
+  /**
+   * Blocks until every submitted task, and any they submit, has finished.
+   */
+  void wait();
+
+private:
+  struct Worker {
+    mutex lock;
+    deque<function<void()>> tasks;
+  };
+
+  bool pop(size_t self, function<void()> &task);
+  void run(size_t self);
+
+  vector<unique_ptr<Worker>> workers;
+  vector<thread> threads;
+
+  /**
+   * queued counts tasks in the deques and changes with them under their
+   * locks; pending also counts tasks running. state is only taken to sleep
+   * on or signal a change of them, or of stopping.
+   */
+  atomic<int64_t> queued{0}, pending{0};
+  atomic<size_t> next{0};
+  mutex state;
+  condition_variable wake, done;
+  bool stopping = false;
+};
+} // namespace tonal
@@ -0,0 +1,710 @@
+#include "emitter.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+using namespace tonal;
+
+namespace {
+uint64_t signature(Atom name, size_t arity) {
+  return static_cast<uint64_t>(name) << 32 | arity;
+}
+
+bool contains(Reification form, Atom atom) {
+  const auto in = instantiation(form);
+  return in.entity == atom || any_of(in.begin(), in.end(), [atom](auto f) {
+           return contains(f, atom);
+         });
+}
+
+/**
+ * A C++ identifier for any tonal name: letters and digits are kept, and
+ * every other byte, underscore included, is written as _ and two hex digits.
+ */
+string identifier(string_view name) {
+  string out;
+  for (unsigned char c : name)
+    if (isalnum(c))
+      out += static_cast<char>(c);
+    else {
+      char escaped[4];
+      snprintf(escaped, sizeof(escaped), "_%02x", c);
+      out += escaped;
+    }
+  return out;
+}
+
+string cpp_type(const Scalar &scalar) {
+  const auto bits = to_string(scalar.bits);
+  switch (scalar.kind) {
+  case Scalar::Kind::BOOLEAN:
+    return "bool";
+  case Scalar::Kind::SIGNED:
+    return "int" + bits + "_t";
+  case Scalar::Kind::UNSIGNED:
+    return "uint" + bits + "_t";
+  case Scalar::Kind::CHARACTER:
+    return scalar.bits == 8 ? "char" : "char" + bits + "_t";
+  case Scalar::Kind::FLOAT:
+    break;
+  }
+  return scalar.bits == 32 ? "float" : "double";
+}
+
+string struct_name(Reification type) {
+  return "s_" + identifier(describe(type));
+}
+
+const char *const runtime = R"(#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+using namespace std;
+
+inline int64_t tonal_add(int64_t l, int64_t r) {
+  return static_cast<int64_t>(static_cast<uint64_t>(l) +
+                              static_cast<uint64_t>(r));
+}
+
+inline int64_t tonal_sub(int64_t l, int64_t r) {
+  return static_cast<int64_t>(static_cast<uint64_t>(l) -
+                              static_cast<uint64_t>(r));
+}
+
+inline int64_t tonal_mul(int64_t l, int64_t r) {
+  return static_cast<int64_t>(static_cast<uint64_t>(l) *
+                              static_cast<uint64_t>(r));
+}
+
+inline int64_t tonal_div(int64_t l, int64_t r) {
+  if (!r)
+    throw runtime_error{"Division by zero"};
+  return r == -1 ? tonal_sub(0, l) : l / r;
+}
+
+inline int64_t tonal_mod(int64_t l, int64_t r) {
+  if (!r)
+    throw runtime_error{"Division by zero"};
+  return r == -1 ? 0 : l % r;
+}
+
+struct tonal_thrown {
+  int64_t value;
+};
+)";
+} // namespace
+
+/**
+ * Writes one specialization, following VirtualMachine::Lowering form for
+ * form so that both agree on evaluation order: a form is written into a
+ * target variable, operands that are not plain locals get a temporary of
+ * their own, and a local is read where it is used rather than copied.
+ * An empty target means the value is not needed.
+ */
+class CppEmitter::Writer {
+public:
+  Writer(CppEmitter &emitter, Specialization specialization)
+      : emitter(emitter), specialization(move(specialization)),
+        body(emitter.bodies[this->specialization.body]) {}
+
+  string definition() {
+    vector<Atom> assigned;
+    for (auto form : body.forms)
+      declare_locals(form, assigned);
+
+    out << "// " << spelling(body.name);
+    for (auto type : specialization.types)
+      out << " " << spelling(type);
+    out << "\n" << emitter.prototype(specialization) << " {\n";
+    /**
+     * Locals may be assigned and never read, as a catch name often is.
+     */
+    for (size_t i = 0; i < body.parameters.size(); ++i) {
+      const auto name = body.parameters[i];
+      const Value parameter{"a_" + identifier(spelling(name)),
+                            specialization.types[i]};
+      if (std::find(begin(assigned), end(assigned), name) == end(assigned)) {
+        parameters.emplace(name, parameter);
+        continue;
+      }
+      const auto local = "l_" + identifier(spelling(name));
+      locals.emplace(name, local);
+      line("[[maybe_unused]] int64_t " + local + " = " + integer(parameter) +
+           ";");
+    }
+    for (auto name : assigned)
+      if (!locals.count(name)) {
+        const auto local = "l_" + identifier(spelling(name));
+        locals.emplace(name, local);
+        line("[[maybe_unused]] int64_t " + local + " = 0;");
+      }
+
+    if (body.forms.empty())
+      line("return 0;");
+    else {
+      line("int64_t result;");
+      for (size_t i = 0; i < body.forms.size(); ++i)
+        lower(body.forms[i], i + 1 < body.forms.size() ? "" : "result");
+      line("return result;");
+    }
+    out << "}\n";
+    return out.str();
+  }
+
+private:
+  struct Value {
+    string expression;
+    Atom type; // A class with a machine type
+  };
+
+  void declare_locals(Reification form, vector<Atom> &assigned) const {
+    const auto in = instantiation(form);
+    if (((in.entity == assign && in.arity == 2) ||
+         (in.entity == catch_ && in.arity >= 1)) &&
+        !instantiation(in.arguments[0]).arity) {
+      const auto name = instantiation(in.arguments[0]).entity;
+      if (std::find(begin(assigned), end(assigned), name) == end(assigned))
+        assigned.push_back(name);
+    }
+    for (auto argument : in)
+      declare_locals(argument, assigned);
+  }
+
+  void line(const string &text) {
+    out << string(2 * indent, ' ') << text << "\n";
+  }
+
+  string temporary() {
+    auto name = "t" + to_string(temporaries++);
+    line("int64_t " + name + ";");
+    return name;
+  }
+
+  string convert(const Value &value, Atom type) const {
+    if (value.type == type)
+      return value.expression;
+    return "static_cast<" + emitter.machine_type(type) + ">(" +
+           value.expression + ")";
+  }
+
+  string integer(const Value &value) const { return convert(value, int64); }
+
+  bool is_local(const string &expression) const {
+    return any_of(begin(locals), end(locals),
+                  [&](auto &local) { return local.second == expression; });
+  }
+
+  [[noreturn]] void fail(const string &what, Reification form) const {
+    throw invalid_argument{what + " in function " +
+                           string{spelling(body.name)} + ": " +
+                           describe(form)};
+  }
+
+  Value operand(Reification form) {
+    const auto in = instantiation(form);
+    if (in.arity) {
+      const auto target = temporary();
+      lower(form, target);
+      return {target, int64};
+    }
+    if (auto local = locals.find(in.entity); local != locals.end())
+      return {local->second, int64};
+    if (auto parameter = parameters.find(in.entity);
+        parameter != parameters.end())
+      return parameter->second;
+    if (in.entity == yes || in.entity == no)
+      return {in.entity == yes ? "1" : "0", int64};
+    try {
+      if (auto value = VirtualMachine::number(in.entity))
+        return {*value == INT64_MIN ? "(-9223372036854775807 - 1)"
+                                    : to_string(*value),
+                int64};
+    } catch (const out_of_range &) {
+      fail("Not a 64-bit integer", form);
+    }
+    if (body.calls.count(form)) {
+      const auto target = temporary();
+      call(form, target);
+      return {target, int64};
+    }
+    fail("Unknown name", form);
+  }
+
+  void lower(Reification form, const string &target) {
+    const auto in = instantiation(form);
+    if (!in.arity) {
+      const auto value = operand(form);
+      if (!target.empty() && value.expression != target)
+        line(target + " = " + integer(value) + ";");
+    } else if (target.empty() && is_operator(in.entity)) {
+      const auto value = temporary();
+      lower(form, value);
+      line("static_cast<void>(" + value + ");");
+    } else if (is_local(target) && !writes_target_last(in))
+      line(target + " = " + operand(form).expression + ";");
+    else
+      compound(form, target);
+  }
+
+  bool is_operator(Atom op) const {
+    return op == add || op == subtract || op == multiply || op == divide ||
+           op == modulo || op == less || op == greater ||
+           op == less_equal || op == greater_equal || op == equal ||
+           op == not_equal || op == negate || op == conjoin ||
+           op == disjoin;
+  }
+
+  bool writes_target_last(const Instantiation &in) const {
+    return in.arity == 2 && (is_operator(in.entity) || in.entity == assign) &&
+           in.entity != negate && in.entity != conjoin &&
+           in.entity != disjoin;
+  }
+
+  void compound(Reification form, const string &target) {
+    const auto in = instantiation(form);
+    const auto op = in.entity;
+    const auto arguments = in.arguments;
+    const auto arity = in.arity;
+
+    if (op == assign && arity == 2) {
+      if (instantiation(arguments[0]).arity)
+        fail("Cannot assign to a form", form);
+      const auto local = locals.at(instantiation(arguments[0]).entity);
+      lower(arguments[1], local);
+      if (!target.empty() && local != target)
+        line(target + " = " + local + ";");
+    } else if (op == add || op == multiply || (op == subtract && arity > 1) ||
+               op == divide || op == modulo) {
+      const auto function = op == add        ? "tonal_add("
+                            : op == multiply ? "tonal_mul("
+                            : op == subtract ? "tonal_sub("
+                            : op == divide   ? "tonal_div("
+                                             : "tonal_mod(";
+      auto left = integer(operand(arguments[0]));
+      for (uint32_t i = 1; i < arity; ++i) {
+        const auto right = integer(operand(arguments[i]));
+        line(target + " = " + function + left + ", " + right + ");");
+        left = target;
+      }
+      if (left != target)
+        line(target + " = " + left + ";");
+    } else if (op == subtract)
+      line(target + " = tonal_sub(0, " + integer(operand(arguments[0])) +
+           ");");
+    else if ((op == less || op == greater || op == less_equal ||
+              op == greater_equal || op == equal || op == not_equal) &&
+             arity == 2) {
+      const auto left = integer(operand(arguments[0]));
+      const auto right = integer(operand(arguments[1]));
+      line(target + " = " + left + " " + string{spelling(op)} + " " + right +
+           ";");
+    } else if (op == negate && arity == 1)
+      line(target + " = !" + operand(arguments[0]).expression + ";");
+    else if ((op == conjoin || op == disjoin) && arity >= 1) {
+      lower(arguments[0], target);
+      for (uint32_t i = 1; i < arity; ++i) {
+        line(string{"if ("} + (op == conjoin ? "" : "!") + target + ") {");
+        ++indent;
+        lower(arguments[i], target);
+      }
+      for (uint32_t i = 1; i < arity; ++i) {
+        --indent;
+        line("}");
+      }
+      line(target + " = " + target + " != 0;");
+    } else if (op == if_ && (arity == 2 || arity == 3)) {
+      line("if (" + operand(arguments[0]).expression + ") {");
+      ++indent;
+      lower(arguments[1], target);
+      --indent;
+      if (arity == 3 || !target.empty()) {
+        line("} else {");
+        ++indent;
+        if (arity == 3)
+          lower(arguments[2], target);
+        else
+          line(target + " = 0;");
+        --indent;
+      }
+      line("}");
+    } else if (op == switch_ && arity >= 1) {
+      const auto value = temporary();
+      lower(arguments[0], value);
+      unsigned open = 0;
+      bool otherwise = false;
+      for (uint32_t i = 1; i < arity; ++i) {
+        const auto clause = instantiation(arguments[i]);
+        if (clause.entity == case_ && clause.arity >= 1 && !otherwise) {
+          const auto label = integer(operand(clause.arguments[0]));
+          line("if (" + value + " == " + label + ") {");
+          ++indent;
+          sequence(clause, 1, target);
+          --indent;
+          line("} else {");
+          ++indent;
+          ++open;
+        } else if (clause.entity == default_ && !otherwise) {
+          sequence(clause, 0, target);
+          otherwise = true;
+        } else
+          fail("Not a case before any default", arguments[i]);
+      }
+      if (!otherwise && !target.empty())
+        line(target + " = 0;");
+      for (; open; --open) {
+        --indent;
+        line("}");
+      }
+    } else if (op == while_ && arity >= 1) {
+      line("for (;;) {");
+      ++indent;
+      line("if (!" + operand(arguments[0]).expression + ")");
+      line("  break;");
+      for (uint32_t i = 1; i < arity; ++i)
+        lower(arguments[i], "");
+      --indent;
+      line("}");
+      if (!target.empty())
+        line(target + " = 0;");
+    } else if (op == for_ && arity >= 3) {
+      lower(arguments[0], "");
+      line("for (;;) {");
+      ++indent;
+      line("if (!" + operand(arguments[1]).expression + ")");
+      line("  break;");
+      for (uint32_t i = 3; i < arity; ++i)
+        lower(arguments[i], "");
+      lower(arguments[2], "");
+      --indent;
+      line("}");
+      if (!target.empty())
+        line(target + " = 0;");
+    } else if (op == throw_ && arity == 1)
+      line("throw tonal_thrown{" + integer(operand(arguments[0])) + "};");
+    else if (op == try_ && arity >= 1) {
+      const auto handler = instantiation(arguments[arity - 1]);
+      if (handler.entity != catch_ || !handler.arity ||
+          instantiation(handler.arguments[0]).arity)
+        fail("No (catch name forms...) ending", form);
+      line("try {");
+      ++indent;
+      ++inside_try;
+      sequence(in, 0, target, arity - 1);
+      --inside_try;
+      --indent;
+      line("} catch (const tonal_thrown &thrown) {");
+      ++indent;
+      line(locals.at(instantiation(handler.arguments[0]).entity) +
+           " = thrown.value;");
+      sequence(handler, 1, target);
+      --indent;
+      line("}");
+    } else if (op == do_) {
+      if (!arity && !target.empty())
+        line(target + " = 0;");
+      for (uint32_t i = 0; i < arity; ++i)
+        lower(arguments[i], i + 1 < arity ? "" : target);
+    } else if (op == return_ && arity <= 1)
+      line("return " + (arity ? integer(operand(arguments[0])) : "0") + ";");
+    else if (op == yield_ && arity == 1) {
+      if (inside_try)
+        fail("Cannot yield inside try", form);
+      const auto value = integer(operand(arguments[0]));
+      line("yield(" + value + ");");
+      if (!target.empty() && value != target)
+        line(target + " = " + value + ";");
+    } else if (op)
+      call(form, target);
+    else
+      fail("Cannot lower", form);
+  }
+
+  /**
+   * The arguments of a clause from first up to last, the last into target,
+   * which is 0 if there are none.
+   */
+  void sequence(const Instantiation &clause, uint32_t first,
+                const string &target, uint32_t last = UINT32_MAX) {
+    last = min(last, clause.arity);
+    if (first == last && !target.empty())
+      line(target + " = 0;");
+    for (uint32_t i = first; i < last; ++i)
+      lower(clause.arguments[i], i + 1 < last ? "" : target);
+  }
+
+  /**
+   * Arguments are copied as they are evaluated, as the machine copies them
+   * into the callee's registers, in case a later one assigns a local.
+   */
+  void call(Reification form, const string &target) {
+    const auto in = instantiation(form);
+    const auto bound = body.calls.find(form);
+    const auto callee = bound == body.calls.end()
+                            ? emitter.find(in.entity, in.arity)
+                            : bound->second;
+    if (callee == VirtualMachine::no_body)
+      fail("No body for a function taking " + to_string(in.arity) +
+               " arguments",
+           form);
+    if (callee == overloaded)
+      fail("More than one function taking " + to_string(in.arity) +
+               " arguments",
+           form);
+    if (emitter.generators[callee])
+      fail("Generators are started from outside", form);
+
+    vector<Value> arguments;
+    vector<Atom> types;
+    for (uint32_t i = 0; i < in.arity; ++i) {
+      auto value = operand(in.arguments[i]);
+      if (i + 1 < in.arity && is_local(value.expression)) {
+        const auto copy = "t" + to_string(temporaries++);
+        line("const int64_t " + copy + " = " + value.expression + ";");
+        value.expression = copy;
+      }
+      types.push_back(emitter.parameter_type(callee, i, value.type));
+      arguments.push_back(move(value));
+    }
+
+    const auto &name =
+        emitter.specializations[emitter.specialize(callee, types)].name;
+    string call = name + "(";
+    for (size_t i = 0; i < arguments.size(); ++i)
+      call += (i ? ", " : "") + convert(arguments[i], types[i]);
+    call += ")";
+    line(target.empty() ? call + ";" : target + " = " + call + ";");
+  }
+
+  CppEmitter &emitter;
+  const Specialization specialization;
+  const VirtualMachine::Body &body;
+  ostringstream out;
+  unsigned indent = 1;
+  uint32_t temporaries = 0;
+  uint32_t inside_try = 0; // Tries enclosing the form being written
+  unordered_map<Atom, string> locals;
+  unordered_map<Atom, Value> parameters; // Those never assigned
+
+  static inline const Atom int64 = intern("int64"), assign = intern("="),
+                           add = intern("+"), subtract = intern("-"),
+                           multiply = intern("*"), divide = intern("/"),
+                           modulo = intern("%"), less = intern("<"),
+                           greater = intern(">"), less_equal = intern("<="),
+                           greater_equal = intern(">="),
+                           equal = intern("=="), not_equal = intern("!="),
+                           negate = intern("!"), conjoin = intern("&&"),
+                           disjoin = intern("||"), if_ = intern("if"),
+                           while_ = intern("while"), do_ = intern("do"),
+                           return_ = intern("return"),
+                           yield_ = intern("yield"), yes = intern("true"),
+                           no = intern("false"), switch_ = intern("switch"),
+                           case_ = intern("case"),
+                           default_ = intern("default"), for_ = intern("for"),
+                           throw_ = intern("throw"), try_ = intern("try"),
+                           catch_ = intern("catch");
+};
+
+CppEmitter::CppEmitter(vector<VirtualMachine::Body> bodies,
+                       LayoutEngine &layouts)
+    : bodies(move(bodies)), layouts(layouts) {
+  static const auto yield = intern("yield");
+  for (size_t i = 0; i < this->bodies.size(); ++i) {
+    const auto &body = this->bodies[i];
+    generators.push_back(any_of(
+        begin(body.forms), end(body.forms),
+        [](Reification form) { return contains(form, yield); }));
+    if (auto [entry, added] = by_signature.emplace(
+            signature(body.name, body.parameters.size()), i);
+        !added)
+      entry->second = overloaded;
+  }
+
+  /**
+   * Untyped values are the machine's, whether or not int64 is declared.
+   */
+  machine_types[intern("int64")] = "int64_t";
+}
+
+bool CppEmitter::add_class(Atom name, const vector<Refinement> &bases) {
+  if (auto type = scalar(bases)) {
+    machine_types[name] = cpp_type(*type);
+    classes.erase(name);
+    return true;
+  }
+  if (!machine_types.count(name))
+    classes.insert(name);
+  return false;
+}
+
+bool CppEmitter::add_struct(Reification type) {
+  try {
+    if (layouts.layout(type).fields.empty())
+      return false;
+  } catch (const invalid_argument &) {
+    return false;
+  }
+  structs.push_back(type);
+  return true;
+}
+
+/**
+ * The body of that name and arity, no_body if none, or overloaded.
+ */
+uint32_t CppEmitter::find(Atom name, size_t arity) const {
+  auto body = by_signature.find(signature(name, arity));
+  return body == by_signature.end() ? VirtualMachine::no_body : body->second;
+}
+
+const string &CppEmitter::machine_type(Atom type) const {
+  auto found = machine_types.find(type);
+  if (found == machine_types.end())
+    throw invalid_argument{"No machine type for class " +
+                           string{spelling(type)}};
+  return found->second;
+}
+
+/**
+ * A parameter naming a class takes that class; any other takes the type of
+ * its argument, which is where concepts are monomorphized.
+ */
+Atom CppEmitter::parameter_type(uint32_t body, size_t parameter,
+                                Atom argument) const {
+  const auto &constraints = bodies[body].constraints;
+  const auto constraint =
+      parameter < constraints.size() ? constraints[parameter] : 0;
+  if (machine_types.count(constraint))
+    return constraint;
+  if (classes.count(constraint))
+    throw invalid_argument{"No machine type for class " +
+                           string{spelling(constraint)} + " in function " +
+                           string{spelling(bodies[body].name)}};
+  return argument;
+}
+
+uint32_t CppEmitter::specialize(uint32_t body, vector<Atom> types) {
+  auto [entry, added] = specialization_index.emplace(
+      make_pair(body, types), static_cast<uint32_t>(specializations.size()));
+  if (added)
+    specializations.push_back(
+        {body, move(types),
+         "f" + to_string(specializations.size()) + "_" +
+             identifier(spelling(bodies[body].name)),
+         generators[body]});
+  return entry->second;
+}
+
+string CppEmitter::prototype(const Specialization &specialization) const {
+  const auto &body = bodies[specialization.body];
+  string out = "int64_t " + specialization.name + "(";
+  if (specialization.generator)
+    out += "const function<void(int64_t)> &yield";
+  for (size_t i = 0; i < body.parameters.size(); ++i)
+    out += (i || specialization.generator ? ", " : "") +
+           machine_type(specialization.types[i]) + " a_" +
+           identifier(spelling(body.parameters[i]));
+  return out + ")";
+}
+
+void CppEmitter::write_struct(Reification type,
+                              unordered_set<Reification> &written,
+                              ostream &out) {
+  static const auto array = intern("array");
+  if (!written.insert(type).second)
+    return;
+  const auto &layout = layouts.layout(type);
+  for (auto &field : layout.fields) {
+    auto element = field.type;
+    while (instantiation(element).entity == array)
+      element = instantiation(element).arguments[0];
+    if (!layouts.layout(element).fields.empty())
+      write_struct(element, written, out);
+  }
+
+  const auto name = struct_name(type);
+  out << "// " << describe(type) << "\nstruct " << name << " {\n";
+  for (auto &field : layout.fields)
+    out << "  " << member(field) << ";\n";
+  out << "};\nstatic_assert(sizeof(" << name << ") == " << layout.size
+      << " && alignof(" << name << ") == " << layout.align << ");\n";
+  for (auto &field : layout.fields)
+    out << "static_assert(offsetof(" << name << ", m_"
+        << identifier(spelling(field.name)) << ") == " << field.offset
+        << ");\n";
+  out << "\n";
+}
+
+/**
+ * A member declaration: the element type, then the name with one extent
+ * per array, outermost first.
+ */
+string CppEmitter::member(const LayoutEngine::Field &field) {
+  static const auto array = intern("array");
+  auto type = field.type;
+  auto size = field.size;
+  string extents;
+  while (instantiation(type).entity == array) {
+    type = instantiation(type).arguments[0];
+    const auto count = size ? size / layouts.layout(type).size : 0;
+    extents += "[" + to_string(count) + "]";
+    size = count ? size / count : 0;
+  }
+  const auto declared = layouts.layout(type).fields.empty()
+                            ? machine_type(instantiation(type).entity)
+                            : struct_name(type);
+  return declared + " m_" + identifier(spelling(field.name)) + extents;
+}
+
+string CppEmitter::program(Atom entry) {
+  specializations.clear();
+  specialization_index.clear();
+  const auto root = find(entry, 0);
+  if (root == VirtualMachine::no_body || root == overloaded)
+    throw invalid_argument{
+        string{root == overloaded ? "More than one " : "No function "} +
+        string{spelling(entry)} + " taking 0 arguments"};
+  specialize(root, {});
+
+  /**
+   * Writing a body specializes what it calls, so the list grows as it is
+   * walked.
+   */
+  vector<string> definitions;
+  for (size_t i = 0; i < specializations.size(); ++i)
+    definitions.push_back(Writer{*this, specializations[i]}.definition());
+
+  ostringstream out;
+  out << "// Written by tonal from " << spelling(entry)
+      << " and what it calls.\n"
+      << runtime << "\n";
+  unordered_set<Reification> written;
+  for (auto type : structs)
+    write_struct(type, written, out);
+  for (auto &specialization : specializations)
+    out << prototype(specialization) << ";\n";
+  for (auto &definition : definitions)
+    out << "\n" << definition;
+  out << "} // namespace\n\n"
+      << "int main() {\n"
+      << "  try {\n"
+      << "    const auto result = " << specializations[0].name
+      << (specializations[0].generator
+              ? "([](int64_t value) { cout << \"YIELD: \" << value << "
+                "\"\\n\"; });\n"
+              : "();\n")
+      << "    cout << \"RETURN: \" << result << \"\\n\";\n"
+      << "  } catch (const tonal_thrown &thrown) {\n"
+      << "    cerr << \"Uncaught throw: \" << thrown.value << \"\\n\";\n"
+      << "    return 1;\n"
+      << "  } catch (const exception &e) {\n"
+      << "    cerr << e.what() << \"\\n\";\n"
+      << "    return 1;\n"
+      << "  }\n"
+      << "}\n";
+  return out.str();
+}
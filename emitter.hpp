@@ -0,0 +1,97 @@
+#pragma once
+
+#include "layout.hpp"
+#include "vm.hpp"
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Writes function bodies out as a C++17 program, for a system compiler to
+ * build into native code.
+ *
+ * Classes stored as a Scalar map to the C++ type of that width, the
+ * machine types of the prelude as much as a file's own. A parameter naming
+ * such a class has that type. A parameter constrained by a concept, or not
+ * at all, is monomorphized: each function is written once per list of
+ * argument types it is called with, starting from the entry function.
+ *
+ * Forms mean what they do on the VirtualMachine: values are 64-bit integers
+ * that wrap, operands and arguments are evaluated left to right, and
+ * division by zero throws. Only a typed parameter keeps its machine type,
+ * until it is assigned; arguments are converted to the parameter's type as
+ * C++ converts them, which the machine matches by narrowing on entry.
+ *
+ * A class with data is written as a struct with its members in memory
+ * order, which C++ lays out as the LayoutEngine did; static_asserts check
+ * that it does. Bodies cannot take or make one yet, as values are integers.
+ */
+class CppEmitter {
+public:
+  CppEmitter(vector<VirtualMachine::Body> bodies, LayoutEngine &layouts);
+
+  /**
+   * Maps a class to a machine type if one of its bases names one. Returns
+   * whether it did.
+   */
+  bool add_class(Atom name, const vector<Refinement> &bases);
+
+  /**
+   * Writes a struct for type, after those of its members, if it is a class
+   * with data that lays out. Returns whether it will.
+   */
+  bool add_struct(Reification type);
+
+  /**
+   * A program that runs entry, which takes no arguments, and prints what it
+   * yields and returns as tonal -r does. Throws invalid_argument for what the
+   * VirtualMachine would not lower, or a parameter type with no machine
+   * type.
+   */
+  string program(Atom entry);
+
+  /**
+   * Functions written by the last program(), one per specialization.
+   */
+  size_t size() const { return specializations.size(); }
+
+private:
+  struct Specialization {
+    uint32_t body;
+    vector<Atom> types; // Class of each parameter
+    string name;
+    bool generator;
+  };
+
+  class Writer;
+
+  static constexpr uint32_t overloaded = VirtualMachine::no_body - 1;
+
+  uint32_t find(Atom name, size_t arity) const;
+  Atom parameter_type(uint32_t body, size_t parameter, Atom argument) const;
+  uint32_t specialize(uint32_t body, vector<Atom> types);
+  const string &machine_type(Atom type) const;
+  string prototype(const Specialization &specialization) const;
+  void write_struct(Reification type, unordered_set<Reification> &written,
+                    ostream &out);
+  string member(const LayoutEngine::Field &field);
+
+  vector<VirtualMachine::Body> bodies;
+  LayoutEngine &layouts;
+  vector<Reification> structs;
+  vector<bool> generators;
+  unordered_map<uint64_t, uint32_t> by_signature; // Name and arity
+  unordered_map<Atom, string> machine_types;
+  unordered_set<Atom> classes; // Those without a machine type
+  vector<Specialization> specializations;
+  map<pair<uint32_t, vector<Atom>>, uint32_t> specialization_index;
+};
+} // namespace tonal
@@ -0,0 +1,135 @@
+#include "evaluator.hpp"
+
+#include <sstream>
+
+using namespace tonal;
+
+size_t ConstantEvaluator::KeyHash::operator()(const Key &key) const {
+  uint64_t h = key.expression * 0x9e3779b97f4a7c15ull;
+  for (auto [name, value] : key.bindings)
+    h = (h ^ (uint64_t{name} << 32 | value)) * 0x100000001b3ull;
+  return h ^ h >> 32;
+}
+
+optional<ConstantEvaluator::Value>
+ConstantEvaluator::evaluate(Reification expression,
+                            const Bindings &bindings) {
+  probe.expression = expression;
+  probe.bindings.assign(begin(bindings), end(bindings));
+  if (auto known = values.find(probe); known != values.end())
+    return known->second;
+  ++evaluated;
+  auto value = fold(expression, bindings);
+  values.emplace(Key{expression, bindings}, value);
+  return value;
+}
+
+Reification ConstantEvaluator::instantiate(Reification expression,
+                                           const Bindings &bindings) {
+  probe.expression = expression;
+  probe.bindings.assign(begin(bindings), end(bindings));
+  if (auto known = instances.find(probe); known != instances.end())
+    return known->second;
+
+  auto instance = expression;
+  if (auto value = evaluate(expression, bindings))
+    instance = reify_value(*value);
+  else if (auto form = instantiation(expression); form.arity) {
+    vector<Reification> arguments;
+    for (auto argument : form)
+      arguments.push_back(instantiate(argument, bindings));
+    instance = reify(form.entity, arguments);
+  } else
+    for (auto [name, value] : bindings)
+      if (name == form.entity)
+        instance = value;
+  instances.emplace(Key{expression, bindings}, instance);
+  return instance;
+}
+
+optional<ConstantEvaluator::Value>
+ConstantEvaluator::fold(Reification expression, const Bindings &bindings) {
+  const auto form = instantiation(expression);
+  if (!form.arity)
+    return leaf(form.entity, bindings);
+
+  const auto op = form.entity;
+  const auto booleans = op == negate || op == conjoin || op == disjoin ||
+                        op == exclusive;
+  const auto numbers = op == add || op == multiply;
+  if (!booleans && !numbers && op != equal && op != less)
+    return {};
+  if ((op == negate && form.arity != 1) ||
+      ((op == equal || op == less) && form.arity != 2))
+    return {};
+
+  vector<Value> operands;
+  for (auto argument : form) {
+    auto value = evaluate(argument);
+    if (!value && !bindings.empty())
+      value = evaluate(argument, bindings);
+    if (!value || (booleans && !holds_alternative<bool>(*value)) ||
+        (numbers && !holds_alternative<Rational>(*value)))
+      return {};
+    if ((op == conjoin && !get<bool>(*value)) ||
+        (op == disjoin && get<bool>(*value)))
+      return value;
+    operands.push_back(move(*value));
+  }
+
+  if (op == negate)
+    return !get<bool>(operands[0]);
+  if (op == conjoin || op == disjoin)
+    return op == conjoin;
+  if (op == exclusive) {
+    auto parity = false;
+    for (auto &operand : operands)
+      parity ^= get<bool>(operand);
+    return parity;
+  }
+  if (op == equal || op == less) {
+    if (operands[0].index() != operands[1].index())
+      return {};
+    return op == equal ? operands[0] == operands[1]
+                       : operands[0] < operands[1];
+  }
+  auto result = get<Rational>(operands[0]);
+  for (size_t i = 1; i < operands.size(); ++i)
+    result = op == add ? result + get<Rational>(operands[i])
+                       : result * get<Rational>(operands[i]);
+  return result;
+}
+
+/**
+ * A name bound to an argument takes its value, true and false are booleans,
+ * and a number is lexed from its spelling once.
+ */
+optional<ConstantEvaluator::Value>
+ConstantEvaluator::leaf(Atom atom, const Bindings &bindings) {
+  for (auto [name, value] : bindings)
+    if (name == atom)
+      return evaluate(value);
+  if (atom == yes || atom == no)
+    return atom == yes;
+
+  auto number = numbers.find(atom);
+  if (number == numbers.end())
+    number = numbers.emplace(atom, Rational::parse(spelling(atom))).first;
+  if (!number->second)
+    return {};
+  return *number->second;
+}
+
+/**
+ * Folded numbers are remembered under their printed spelling, which the
+ * lexer may not read back, as with 1/3.
+ */
+Reification ConstantEvaluator::reify_value(const Value &value) {
+  if (auto boolean = get_if<bool>(&value))
+    return reify(*boolean ? yes : no);
+  ostringstream text;
+  text << get<Rational>(value);
+  const auto atom = intern(text.str());
+  numbers.emplace(atom, get<Rational>(value));
+  return reify(atom);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "number.hpp"
+#include "reification.hpp"
+
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Folds literal expressions at compile time, such as
+ * (+ l.template.length r.template.length) once l and r are known.
+ *
+ * Expressions are reifications, so equal expressions are one id and a fold
+ * is memoized per (expression, bindings): instantiating a template again
+ * with the same arguments costs a hash lookup. Numbers are exact rationals.
+ * The operators are those lang.decl gives literal overloads for: ! && || ^
+ * on booleans, + * on numbers and == < on either, with && and || stopping
+ * at the first operand that decides them.
+ */
+class ConstantEvaluator {
+public:
+  using Value = variant<bool, Rational>;
+
+  /**
+   * Names standing for literal arguments, each bound to a reification.
+   */
+  using Bindings = vector<pair<Atom, Reification>>;
+
+  /**
+   * The value of the expression, or none if any part of what it needs is
+   * not constant.
+   */
+  optional<Value> evaluate(Reification expression,
+                           const Bindings &bindings = {});
+
+  /**
+   * The expression with bound names replaced and every constant part folded
+   * to its value, as in (array element 7) for
+   * (array element (+ l.template.length r.template.length)).
+   */
+  Reification instantiate(Reification expression,
+                          const Bindings &bindings = {});
+
+  /**
+   * Number of folds worked out rather than taken from the memo.
+   */
+  size_t evaluations() const { return evaluated; }
+
+private:
+  struct Key {
+    Reification expression;
+    Bindings bindings;
+    friend bool operator==(const Key &l, const Key &r) {
+      return l.expression == r.expression && l.bindings == r.bindings;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  optional<Value> fold(Reification expression, const Bindings &bindings);
+  optional<Value> leaf(Atom atom, const Bindings &bindings);
+  Reification reify_value(const Value &value);
+
+  unordered_map<Key, optional<Value>, KeyHash> values;
+  unordered_map<Key, Reification, KeyHash> instances;
+  unordered_map<Atom, optional<Rational>> numbers; // By spelling
+  Key probe;                                       // Reused for lookups
+  size_t evaluated = 0;
+  Atom yes = intern("true"), no = intern("false");
+  Atom negate = intern("!"), conjoin = intern("&&"), disjoin = intern("||");
+  Atom exclusive = intern("^"), equal = intern("=="), less = intern("<");
+  Atom add = intern("+"), multiply = intern("*");
+};
+} // namespace tonal
@@ -1,28 +1,24 @@
 #include "identifier.hpp"
 
-#include <regex>
-
 using namespace tonal;
 
-static const regex identifier_rx{
-    "[_\\-[:alpha:]][_\\-.[:alnum:]]*[_\\-[:alnum:]]+"};
-
 Identifier::Identifier(const string_view &ident)
-    : m_fully_qualified(ident), m_scope(m_fully_qualified),
-      m_name(m_fully_qualified) {
-  if (!regex_match(begin(m_fully_qualified), end(m_fully_qualified),
-                   identifier_rx))
-    throw invalid_identifier{"Invalid identifier: " +
-                             string{m_fully_qualified}};
-
-  m_scope.remove_suffix(m_scope.size() - m_scope.rfind('.'));
-  m_name.remove_prefix(m_name.rfind('.') + 1);
+    : Identifier(intern(ident)) {}
+
+Identifier::Identifier(Atom fully_qualified)
+    : m_fully_qualified(fully_qualified), m_scope(0),
+      m_name(fully_qualified) {
+  auto ident = spelling(fully_qualified);
+  if (auto dot = ident.rfind('.'); dot != string_view::npos) {
+    m_scope = intern(ident.substr(0, dot));
+    m_name = intern(ident.substr(dot + 1));
+  }
 }
 
-string_view Identifier::name() const { return m_name; }
+string_view Identifier::name() const { return spelling(m_name); }
 
-string_view Identifier::scope() const { return m_scope; }
+string_view Identifier::scope() const { return spelling(m_scope); }
 
-uint32_t std::hash<Identifier>::operator()(const Identifier &ident) const {
-  return hash<string_view>{}(ident.m_fully_qualified);
+size_t std::hash<Identifier>::operator()(const Identifier &ident) const {
+  return ident.m_fully_qualified;
 }
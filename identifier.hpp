@@ -1,5 +1,7 @@
 #pragma once
 
+#include "atom.hpp"
+
 #include <memory>
 #include <string>
 #include <string_view>
@@ -8,19 +10,25 @@
 namespace tonal {
 using namespace std;
 
-struct invalid_identifier : invalid_argument {
-  using invalid_argument::invalid_argument;
-};
-
+/**
+ * A possibly qualified name, held as the atoms of the whole name, of the
+ * scope before its last period and of the name after it. The text is
+ * trusted to have passed the lexer's identifier checks.
+ */
 struct Identifier {
   Identifier(const string_view &);
-  Identifier(const Identifier &);
-  Identifier(Identifier &&) = default;
-  Identifier &operator=(const Identifier &);
-  Identifier &operator=(Identifier &&) = default;
+  explicit Identifier(Atom fully_qualified);
 
   string_view scope() const;
   string_view name() const;
+  Atom atom() const { return m_fully_qualified; }
+
+  friend bool operator==(const Identifier &l, const Identifier &r) {
+    return l.m_fully_qualified == r.m_fully_qualified;
+  }
+  friend bool operator!=(const Identifier &l, const Identifier &r) {
+    return !(l == r);
+  }
 
   // type
   // scope
@@ -37,14 +45,14 @@ struct Identifier {
   // relative - number of parentheses encountered
 
 private:
-  string_view m_fully_qualified;
-  string_view m_scope;
-  string_view m_name;
+  Atom m_fully_qualified;
+  Atom m_scope;
+  Atom m_name;
 
   friend struct std::hash<Identifier>;
 };
 } // namespace tonal
 
 template <> struct ::std::hash<tonal::Identifier> {
-  uint32_t operator()(const tonal::Identifier &) const;
+  size_t operator()(const tonal::Identifier &) const;
 };
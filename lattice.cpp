@@ -0,0 +1,153 @@
+#include "lattice.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace tonal;
+
+namespace {
+constexpr const char *literal_concepts[] = {"boolean", "integer", "rational",
+                                            "string"};
+} // namespace
+
+size_t ConceptLattice::KeyHash::operator()(const Key &key) const {
+  uint64_t h = key.type * 0x9e3779b97f4a7c15ull ^ key.requirement.concept;
+  for (auto argument : key.requirement.arguments)
+    h = (h ^ argument) * 0x100000001b3ull;
+  return h ^ h >> 32;
+}
+
+void ConceptLattice::add_concept(Atom name, vector<Atom> parameters,
+                                 vector<Refinement> bases) {
+  concept_index[name] = concepts.size();
+  concepts.push_back({name, move(parameters), move(bases), {}});
+}
+
+void ConceptLattice::add_class(Atom name, vector<Atom> parameters,
+                               vector<Refinement> bases) {
+  classes[name] = {move(parameters), move(bases), {}, {}};
+}
+
+void ConceptLattice::build() {
+  for (auto i = 0; i < 4; ++i)
+    classes[literal_types[i]] = {
+        {}, {{intern(literal_concepts[i]), {}}, {literal, {}}}, {}, {}};
+
+  visiting.assign(concepts.size(), 0);
+  for (uint32_t i = 0; i < concepts.size(); ++i)
+    ancestors(i);
+  for (auto &entry : classes)
+    add_facts(entry.second);
+  memo.clear();
+}
+
+const ConceptLattice::Bits &ConceptLattice::ancestors(uint32_t concept) {
+  auto &info = concepts[concept];
+  if (visiting[concept] == 2)
+    return info.ancestors;
+  if (visiting[concept] == 1)
+    throw invalid_argument{"Concept refines itself: " +
+                           string{spelling(info.name)}};
+
+  visiting[concept] = 1;
+  Bits bits((concepts.size() + 63) / 64);
+  set(bits, concept);
+  for (auto &base : info.bases)
+    if (auto b = concept_index.find(base.concept); b != concept_index.end()) {
+      const auto &inherited = ancestors(b->second);
+      for (size_t w = 0; w < bits.size(); ++w)
+        bits[w] |= inherited[w];
+    }
+  visiting[concept] = 2;
+  return concepts[concept].ancestors = move(bits);
+}
+
+/**
+ * Walks up from the class's bases, substituting each concept's arguments
+ * for its parameters in the bases it refines.
+ */
+void ConceptLattice::add_facts(ClassInfo &type) {
+  type.satisfied.assign((concepts.size() + 63) / 64, 0);
+  vector<Refinement> pending;
+  for (auto base : type.bases) {
+    for (auto &argument : base.arguments)
+      if (find(begin(type.parameters), end(type.parameters), argument) !=
+          end(type.parameters))
+        argument = 0;
+    pending.push_back(move(base));
+  }
+
+  while (!pending.empty()) {
+    auto fact = move(pending.back());
+    pending.pop_back();
+    auto c = concept_index.find(fact.concept);
+    if (c == concept_index.end() ||
+        find(begin(type.facts), end(type.facts), fact) != end(type.facts))
+      continue;
+
+    const auto &info = concepts[c->second];
+    set(type.satisfied, c->second);
+    for (auto base : info.bases) {
+      for (auto &argument : base.arguments) {
+        auto p = find(begin(info.parameters), end(info.parameters), argument);
+        if (p == end(info.parameters))
+          continue;
+        auto i = static_cast<size_t>(p - begin(info.parameters));
+        argument = i < fact.arguments.size() ? fact.arguments[i] : 0;
+      }
+      pending.push_back(move(base));
+    }
+    type.facts.push_back(move(fact));
+  }
+}
+
+bool ConceptLattice::refines(Atom concept, Atom base) const {
+  auto c = concept_index.find(concept), b = concept_index.find(base);
+  return c != concept_index.end() && b != concept_index.end() &&
+         test(concepts[c->second].ancestors, b->second);
+}
+
+bool ConceptLattice::matches(const Refinement &fact,
+                             const Refinement &requirement) const {
+  if (fact.concept != requirement.concept)
+    return false;
+  for (size_t i = 0; i < requirement.arguments.size(); ++i) {
+    auto wanted = requirement.arguments[i];
+    auto given = i < fact.arguments.size() ? fact.arguments[i] : 0;
+    if (wanted && wanted != any && given && given != any && wanted != given)
+      return false;
+  }
+  return true;
+}
+
+bool ConceptLattice::satisfies(Atom type, const Refinement &requirement) {
+  auto t = classes.find(type);
+  auto c = concept_index.find(requirement.concept);
+  if (t == classes.end() || c == concept_index.end() ||
+      !test(t->second.satisfied, c->second))
+    return false;
+
+  Key key{type, requirement};
+  if (auto known = memo.find(key); known != memo.end())
+    return known->second;
+  ++evaluated;
+  const auto &facts = t->second.facts;
+  auto result = any_of(begin(facts), end(facts), [&](const Refinement &fact) {
+    return matches(fact, requirement);
+  });
+  memo.emplace(move(key), result);
+  return result;
+}
+
+bool ConceptLattice::satisfies(Literal literal,
+                               const Refinement &requirement) {
+  return satisfies(literal_type(literal), requirement);
+}
+
+bool ConceptLattice::converts(Atom literal, Atom type) {
+  for (auto i = 0; i < 4; ++i)
+    if (literal_types[i] == literal)
+      return satisfies(type, {intern(literal_concepts[i]), {}});
+  return false;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "atom.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * A concept applied to arguments, as in (: (integer false 32)). Each
+ * argument is the atom of its spelling: a parameter name, true, false, a
+ * number or a whole nested list. Missing trailing arguments are free.
+ */
+struct Refinement {
+  Atom concept = 0;
+  vector<Atom> arguments;
+
+  friend bool operator==(const Refinement &l, const Refinement &r) {
+    return l.concept == r.concept && l.arguments == r.arguments;
+  }
+};
+
+/**
+ * Decides whether a class or a literal satisfies a concept with given
+ * arguments.
+ *
+ * Concepts are numbered once all are known, and each gets a bitset of every
+ * concept it refines, directly or not, so refines() is one bit test. Every
+ * class gets the bitset of concepts it satisfies under some arguments, which
+ * rejects most queries outright. The rest compare arguments against the
+ * class's facts: its bases, and their bases in turn with parameters
+ * substituted. Answers are memoized per (class, concept, arguments).
+ *
+ * An argument matches an equal one, and anything matches a free argument:
+ * one left out, `any`, or a template parameter of the class.
+ */
+class ConceptLattice {
+public:
+  /**
+   * The kinds of literal values, each treated as a class refining the
+   * concept lang.decl declares for it and `literal`.
+   */
+  enum class Literal : char { BOOLEAN, INTEGER, RATIONAL, STRING };
+
+  void add_concept(Atom name, vector<Atom> parameters,
+                   vector<Refinement> bases);
+  void add_class(Atom name, vector<Atom> parameters,
+                 vector<Refinement> bases);
+
+  /**
+   * Links names, computes bitsets and facts. Throws invalid_argument if a
+   * concept refines itself. Bases naming unknown concepts are ignored, as
+   * they may come from modules not seen here.
+   */
+  void build();
+
+  /**
+   * Whether concept refines base, directly or not. A concept refines
+   * itself.
+   */
+  bool refines(Atom concept, Atom base) const;
+
+  bool is_concept(Atom name) const { return concept_index.count(name); }
+  bool is_class(Atom name) const { return classes.count(name); }
+
+  /**
+   * The pseudo-class standing for literals of a kind.
+   */
+  Atom literal_type(Literal literal) const {
+    return literal_types[static_cast<int>(literal)];
+  }
+
+  bool satisfies(Atom type, const Refinement &requirement);
+  bool satisfies(Literal literal, const Refinement &requirement);
+
+  /**
+   * Whether a literal of the pseudo-class literal can stand for a value of
+   * a class: the class satisfies the concept of the literal's kind, as
+   * uint8 does integer.
+   */
+  bool converts(Atom literal, Atom type);
+
+  /**
+   * Number of answers worked out rather than taken from the memo.
+   */
+  size_t evaluations() const { return evaluated; }
+
+private:
+  using Bits = vector<uint64_t>;
+
+  struct ConceptInfo {
+    Atom name;
+    vector<Atom> parameters;
+    vector<Refinement> bases;
+    Bits ancestors;
+  };
+
+  struct ClassInfo {
+    vector<Atom> parameters;
+    vector<Refinement> bases, facts;
+    Bits satisfied;
+  };
+
+  struct Key {
+    Atom type;
+    Refinement requirement;
+    friend bool operator==(const Key &l, const Key &r) {
+      return l.type == r.type && l.requirement == r.requirement;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  static bool test(const Bits &bits, size_t i) {
+    return i / 64 < bits.size() && bits[i / 64] >> (i % 64) & 1;
+  }
+  static void set(Bits &bits, size_t i) {
+    bits[i / 64] |= uint64_t{1} << i % 64;
+  }
+
+  const Bits &ancestors(uint32_t concept);
+  void add_facts(ClassInfo &type);
+  bool matches(const Refinement &fact, const Refinement &requirement) const;
+
+  vector<ConceptInfo> concepts;
+  unordered_map<Atom, uint32_t> concept_index;
+  unordered_map<Atom, ClassInfo> classes;
+  vector<char> visiting; // 1 while on the ancestor walk's path, 2 once done
+  unordered_map<Key, bool, KeyHash> memo;
+  size_t evaluated = 0;
+  Atom any = intern("any"), literal = intern("literal");
+  Atom literal_types[4] = {intern("<boolean literal>"),
+                           intern("<integer literal>"),
+                           intern("<rational literal>"),
+                           intern("<string literal>")};
+};
+} // namespace tonal
@@ -0,0 +1,177 @@
+#include "layout.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+using namespace tonal;
+
+namespace {
+uint64_t align_up(uint64_t offset, uint64_t align) {
+  return (offset + align - 1) / align * align;
+}
+
+uint64_t multiply(uint64_t l, uint64_t r, Reification type) {
+  uint64_t product;
+  if (__builtin_mul_overflow(l, r, &product))
+    throw invalid_argument{"Too large to lay out: " + describe(type)};
+  return product;
+}
+
+/**
+ * Offsets for fields in their current order, returning the end of the last.
+ */
+uint64_t place(vector<LayoutEngine::Field> &fields) {
+  uint64_t end = 0;
+  for (auto &field : fields) {
+    field.offset = align_up(end, field.align);
+    end = field.offset + field.size;
+  }
+  return end;
+}
+
+void by_alignment(vector<LayoutEngine::Field> &fields) {
+  stable_sort(begin(fields), end(fields),
+              [](auto &l, auto &r) { return l.align > r.align; });
+}
+} // namespace
+
+optional<Scalar> tonal::scalar(const vector<Refinement> &bases) {
+  using Kind = Scalar::Kind;
+  for (auto &base : bases) {
+    const auto concept = spelling(base.concept);
+    vector<string_view> arguments;
+    for (auto argument : base.arguments)
+      arguments.push_back(spelling(argument));
+    const auto text = arguments.empty() ? "" : arguments.back();
+    const uint32_t bits = text == "8"    ? 8
+                          : text == "16" ? 16
+                          : text == "32" ? 32
+                          : text == "64" ? 64
+                                         : 0;
+
+    if (concept == "boolean" && arguments.empty())
+      return Scalar{Kind::BOOLEAN, 8};
+    if (concept == "integer" && arguments.size() == 2 && bits &&
+        (arguments[0] == "true" || arguments[0] == "false"))
+      return Scalar{arguments[0] == "true" ? Kind::SIGNED : Kind::UNSIGNED,
+                    bits};
+    if (concept == "character" && arguments.size() == 1 && bits &&
+        bits != 64)
+      return Scalar{Kind::CHARACTER, bits};
+    if (concept == "rational" && arguments.size() == 2 &&
+        arguments[0] == "true" && bits >= 32)
+      return Scalar{Kind::FLOAT, bits};
+  }
+  return {};
+}
+
+LayoutEngine::LayoutEngine(ConstantEvaluator &constants)
+    : constants(constants) {}
+
+void LayoutEngine::add_class(Atom name, vector<Atom> parameters,
+                             const vector<Refinement> &bases,
+                             vector<pair<Atom, Reification>> data) {
+  auto &info = classes[name];
+  info.parameters = move(parameters);
+  info.scalar = scalar(bases);
+  info.declared_order = any_of(begin(bases), end(bases), [this](auto &base) {
+    return base.concept == declared_layout;
+  });
+  info.data = move(data);
+}
+
+const LayoutEngine::Layout &LayoutEngine::layout(Reification type) {
+  if (auto found = layouts.find(type); found != layouts.end())
+    return found->second;
+  if (!visiting.insert(type).second)
+    throw invalid_argument{describe(type) + " contains itself"};
+  try {
+    auto computed = compute(type);
+    visiting.erase(type);
+    ++evaluated;
+    return layouts.emplace(type, move(computed)).first->second;
+  } catch (...) {
+    visiting.erase(type);
+    throw;
+  }
+}
+
+LayoutEngine::Layout LayoutEngine::compute(Reification type) {
+  const auto in = instantiation(type);
+  if (in.entity == array && in.arity == 2) {
+    const auto &element = layout(in.arguments[0]);
+    const auto size =
+        multiply(element.size, length(in.arguments[1], type), type);
+    return {size, element.align, size, {}};
+  }
+
+  auto found = classes.find(in.entity);
+  if (found == classes.end())
+    throw invalid_argument{"No class to lay out: " + describe(type)};
+  const auto &info = found->second;
+  if (in.arity != info.parameters.size())
+    throw invalid_argument{"Wrong number of template arguments: " +
+                           describe(type)};
+  if (info.scalar) {
+    const uint64_t bytes = info.scalar->bits / 8;
+    return {bytes, bytes, bytes, {}};
+  }
+  if (info.data.empty())
+    throw invalid_argument{"No data to lay out: " + describe(type)};
+
+  ConstantEvaluator::Bindings bindings;
+  for (uint32_t i = 0; i < in.arity; ++i)
+    bindings.emplace_back(info.parameters[i], in.arguments[i]);
+  Layout result;
+  for (auto &[name, written] : info.data) {
+    const auto member = constants.instantiate(written, bindings);
+    const auto &inner = layout(member);
+    result.fields.push_back({name, member, 0, inner.size, inner.align});
+    result.align = max(result.align, inner.align);
+  }
+
+  result.declared_size = align_up(place(result.fields), result.align);
+  if (!info.declared_order)
+    by_alignment(result.fields);
+  result.size = align_up(place(result.fields), result.align);
+  return result;
+}
+
+/**
+ * The length of an array type, which must fold to a natural number.
+ */
+uint64_t LayoutEngine::length(Reification expression, Reification type) {
+  const auto value = constants.evaluate(expression);
+  const auto number = value ? get_if<Rational>(&*value) : nullptr;
+  if (!number || !number->is_integer() ||
+      (number->negative && !number->numerator.is_zero()) ||
+      !number->numerator.is_small())
+    throw invalid_argument{"Array length is not a constant: " +
+                           describe(type)};
+  return number->numerator.value();
+}
+
+const LayoutEngine::Columns &LayoutEngine::columns(Reification type) {
+  if (auto found = column_layouts.find(type); found != column_layouts.end())
+    return found->second;
+  const auto in = instantiation(type);
+  if (in.entity != array || in.arity != 2 ||
+      layout(in.arguments[0]).fields.empty())
+    throw invalid_argument{"Not an array of a class with data: " +
+                           describe(type)};
+
+  const auto &element = layout(in.arguments[0]);
+  const auto count = length(in.arguments[1], type);
+  Columns result;
+  result.rows_size = layout(type).size;
+  result.columns = element.fields;
+  by_alignment(result.columns);
+  for (auto &column : result.columns) {
+    column.size = multiply(column.size, count, type);
+    result.align = max(result.align, column.align);
+  }
+  result.size = align_up(place(result.columns), result.align);
+  ++evaluated;
+  return column_layouts.emplace(type, move(result)).first->second;
+}
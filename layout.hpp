@@ -0,0 +1,112 @@
+#pragma once
+
+#include "evaluator.hpp"
+#include "lattice.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * A class stored as one machine value: one refining boolean,
+ * (integer signed bitsize), (character bitsize) or
+ * (rational true bitsize), with a bitsize of 8, 16, 32 or 64.
+ */
+struct Scalar {
+  enum class Kind : char { BOOLEAN, SIGNED, UNSIGNED, CHARACTER, FLOAT };
+  Kind kind;
+  uint32_t bits;
+};
+
+/**
+ * The scalar named by the first base that names one, if any.
+ */
+optional<Scalar> scalar(const vector<Refinement> &bases);
+
+/**
+ * Lays out concrete classes: scalars, classes of data members, and
+ * (array type length) of either.
+ *
+ * A class's members are ordered by alignment, largest first, which leaves
+ * no padding between them as every size is a multiple of its alignment.
+ * A class refining declared-layout keeps declaration order, as when the
+ * layout is shared with C. Template parameters are bound to the arguments
+ * of the reified class and constant expressions folded, so each
+ * instantiation is laid out, and cached, under its own reification.
+ */
+class LayoutEngine {
+public:
+  struct Field {
+    Atom name;
+    Reification type;
+    uint64_t offset, size, align;
+  };
+
+  struct Layout {
+    uint64_t size = 0, align = 1;
+    uint64_t declared_size = 0; // In declaration order, for comparison
+    vector<Field> fields;       // In memory order
+  };
+
+  /**
+   * An array of classes stored as one array per member, each starting at
+   * offset, so a loop over one member reads contiguous memory.
+   */
+  struct Columns {
+    uint64_t size = 0, align = 1;
+    uint64_t rows_size = 0; // As an array of whole elements
+    vector<Field> columns;  // size and align are of the whole column
+  };
+
+  explicit LayoutEngine(ConstantEvaluator &constants);
+
+  /**
+   * data is each member's name and type as written, in declaration order.
+   */
+  void add_class(Atom name, vector<Atom> parameters,
+                 const vector<Refinement> &bases,
+                 vector<pair<Atom, Reification>> data);
+
+  /**
+   * Throws invalid_argument for a type that is not concrete: an unknown
+   * class, one without data or a machine type, a length that is not a
+   * constant, or a class containing itself.
+   */
+  const Layout &layout(Reification type);
+
+  /**
+   * Throws invalid_argument unless type is an array of a class with data.
+   */
+  const Columns &columns(Reification type);
+
+  /**
+   * Number of layouts worked out rather than taken from the cache.
+   */
+  size_t evaluations() const { return evaluated; }
+
+private:
+  struct ClassInfo {
+    vector<Atom> parameters;
+    optional<Scalar> scalar;
+    bool declared_order = false;
+    vector<pair<Atom, Reification>> data;
+  };
+
+  Layout compute(Reification type);
+  uint64_t length(Reification expression, Reification type);
+
+  ConstantEvaluator &constants;
+  unordered_map<Atom, ClassInfo> classes;
+  unordered_map<Reification, Layout> layouts;
+  unordered_map<Reification, Columns> column_layouts;
+  unordered_set<Reification> visiting;
+  size_t evaluated = 0;
+  Atom array = intern("array"), declared_layout = intern("declared-layout");
+};
+} // namespace tonal
@@ -0,0 +1,383 @@
+#include "number.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+using namespace tonal;
+
+namespace {
+/**
+ * Appends digits to n, as many at a time as fit a 32-bit multiplier, and
+ * multiplies scale by the base once per digit if given.
+ */
+void append_digits(Natural &n, int base, string_view digits,
+                   Natural *scale = nullptr) {
+  uint32_t chunk = 0, multiplier = 1;
+  for (auto c : digits) {
+    if (is_digit_separator(c))
+      continue;
+    if (multiplier > UINT32_MAX / base) {
+      n.multiply_add(multiplier, chunk);
+      if (scale)
+        scale->multiply_add(multiplier, 0);
+      chunk = 0;
+      multiplier = 1;
+    }
+    chunk = chunk * base + digit_value(c, base);
+    multiplier *= base;
+  }
+  if (multiplier > 1) {
+    n.multiply_add(multiplier, chunk);
+    if (scale)
+      scale->multiply_add(multiplier, 0);
+  }
+}
+
+Natural power(uint32_t radix, uint64_t exponent) {
+  Natural result = 1, square = radix;
+  for (; exponent; exponent >>= 1) {
+    if (exponent & 1)
+      result = result * square;
+    if (exponent > 1)
+      square = square * square;
+  }
+  return result;
+}
+} // namespace
+
+int tonal::digit_value(char c, int base) {
+  int value = 64;
+  if (c >= '0' && c <= '9')
+    value = c - '0';
+  else if (c >= 'a' && c <= 'z')
+    value = c - 'a' + 10;
+  else if (c >= 'A' && c <= 'Z')
+    value = c - 'A' + (base > 36 ? 36 : 10);
+  else if (c == '+')
+    value = 62;
+  else if (c == '\\')
+    value = 63;
+  return value < base ? value : -1;
+}
+
+void Natural::multiply_add(uint32_t m, uint32_t a) {
+  if (is_small()) {
+    uint64_t product, sum;
+    if (!__builtin_mul_overflow(small, m, &product) &&
+        !__builtin_add_overflow(product, a, &sum)) {
+      small = sum;
+      return;
+    }
+    limbs = {static_cast<uint32_t>(small), static_cast<uint32_t>(small >> 32)};
+  }
+
+  uint64_t carry = a;
+  for (auto &limb : limbs) {
+    carry += static_cast<uint64_t>(limb) * m;
+    limb = static_cast<uint32_t>(carry);
+    carry >>= 32;
+  }
+  if (carry)
+    limbs.push_back(static_cast<uint32_t>(carry));
+  normalize();
+}
+
+uint32_t Natural::divide(uint32_t d) {
+  if (is_small()) {
+    auto r = small % d;
+    small /= d;
+    return r;
+  }
+
+  uint64_t r = 0;
+  for (auto limb = rbegin(limbs); limb != rend(limbs); ++limb) {
+    r = r << 32 | *limb;
+    *limb = static_cast<uint32_t>(r / d);
+    r %= d;
+  }
+  normalize();
+  return r;
+}
+
+uint32_t Natural::remainder(uint32_t d) const {
+  if (is_small())
+    return small % d;
+
+  uint64_t r = 0;
+  for (auto limb = rbegin(limbs); limb != rend(limbs); ++limb)
+    r = (r << 32 | *limb) % d;
+  return r;
+}
+
+Natural &Natural::operator+=(const Natural &r) {
+  uint64_t total;
+  if (is_small() && r.is_small() &&
+      !__builtin_add_overflow(small, r.small, &total)) {
+    small = total;
+    return *this;
+  }
+
+  auto sum = digits(), addend = r.digits();
+  if (sum.size() < addend.size())
+    sum.resize(addend.size());
+  uint64_t carry = 0;
+  for (size_t i = 0; i < sum.size(); ++i) {
+    carry += sum[i] + uint64_t{i < addend.size() ? addend[i] : 0};
+    sum[i] = static_cast<uint32_t>(carry);
+    carry >>= 32;
+  }
+  if (carry)
+    sum.push_back(static_cast<uint32_t>(carry));
+  limbs = move(sum);
+  normalize();
+  return *this;
+}
+
+Natural &Natural::operator-=(const Natural &r) {
+  if (is_small()) {
+    small -= r.small;
+    return *this;
+  }
+
+  auto difference = digits(), subtrahend = r.digits();
+  uint64_t borrow = 0;
+  for (size_t i = 0; i < difference.size(); ++i) {
+    auto d = difference[i] - borrow -
+             (i < subtrahend.size() ? subtrahend[i] : 0);
+    difference[i] = static_cast<uint32_t>(d);
+    borrow = d >> 63;
+  }
+  limbs = move(difference);
+  normalize();
+  return *this;
+}
+
+Natural tonal::operator*(const Natural &l, const Natural &r) {
+  uint64_t product;
+  if (l.is_small() && r.is_small() &&
+      !__builtin_mul_overflow(l.small, r.small, &product))
+    return product;
+
+  const auto a = l.digits(), b = r.digits();
+  Natural n;
+  n.limbs.assign(a.size() + b.size(), 0);
+  for (size_t i = 0; i < a.size(); ++i) {
+    uint64_t carry = 0;
+    for (size_t j = 0; j < b.size(); ++j) {
+      carry += static_cast<uint64_t>(a[i]) * b[j] + n.limbs[i + j];
+      n.limbs[i + j] = static_cast<uint32_t>(carry);
+      carry >>= 32;
+    }
+    n.limbs[i + b.size()] = static_cast<uint32_t>(carry);
+  }
+  n.normalize();
+  return n;
+}
+
+/**
+ * A value with limbs is never below 2^64, so only equal kinds need looking
+ * into.
+ */
+bool tonal::operator<(const Natural &l, const Natural &r) {
+  if (l.is_small() || r.is_small())
+    return l.is_small() && (!r.is_small() || l.small < r.small);
+  if (l.limbs.size() != r.limbs.size())
+    return l.limbs.size() < r.limbs.size();
+  return lexicographical_compare(rbegin(l.limbs), rend(l.limbs),
+                                 rbegin(r.limbs), rend(r.limbs));
+}
+
+/**
+ * Little-endian limbs of the value, however it is held.
+ */
+vector<uint32_t> Natural::digits() const {
+  if (!is_small())
+    return limbs;
+  if (small >> 32)
+    return {static_cast<uint32_t>(small), static_cast<uint32_t>(small >> 32)};
+  return {static_cast<uint32_t>(small)};
+}
+
+void Natural::normalize() {
+  while (!limbs.empty() && !limbs.back())
+    limbs.pop_back();
+  if (limbs.size() <= 2) {
+    small = 0;
+    for (auto limb = rbegin(limbs); limb != rend(limbs); ++limb)
+      small = small << 32 | *limb;
+    limbs.clear();
+  } else
+    small = 0;
+}
+
+ostream &tonal::operator<<(ostream &out, const Natural &n) {
+  if (n.is_small())
+    return out << n.value();
+
+  auto quotient = n;
+  string digits;
+  while (!quotient.is_zero()) {
+    auto chunk = to_string(quotient.divide(1000000000));
+    if (!quotient.is_zero())
+      chunk.insert(0, 9 - chunk.size(), '0');
+    digits.insert(0, chunk);
+  }
+  return out << digits;
+}
+
+void Rational::reduce() {
+  for (uint32_t p : {2, 3, 5})
+    while (denominator.remainder(p) == 0 && numerator.remainder(p) == 0 &&
+           !numerator.is_zero()) {
+      numerator.divide(p);
+      denominator.divide(p);
+    }
+  if (numerator.is_zero())
+    denominator = 1;
+}
+
+/**
+ * The value is (integer.fraction) * radix ^ exponent. Digits are read a
+ * chunk at a time and the power is taken by squaring, so long numbers and
+ * large exponents cost a few passes over the limbs rather than one per
+ * digit.
+ */
+Rational Rational::from_digits(bool negative, int base, string_view integer,
+                               string_view fraction, int radix,
+                               int64_t exponent) {
+  Rational value;
+  value.negative = negative;
+  append_digits(value.numerator, base, integer);
+  append_digits(value.numerator, base, fraction, &value.denominator);
+  if (exponent) {
+    auto &scaled = exponent < 0 ? value.denominator : value.numerator;
+    const auto magnitude = static_cast<uint64_t>(exponent);
+    scaled = scaled * power(radix, exponent < 0 ? 0 - magnitude : magnitude);
+  }
+  value.reduce();
+  return value;
+}
+
+optional<Rational> Rational::parse(string_view text) {
+  const auto negative = !text.empty() && text[0] == '-';
+  if (!text.empty() && (text[0] == '-' || text[0] == '+'))
+    text.remove_prefix(1);
+
+  int base = 10, radix = 10;
+  char exponent_point = 'e';
+  if (text.size() > 1 && text[0] == '0' &&
+      isalpha(static_cast<unsigned char>(text[1]))) {
+    switch (text[1]) {
+    default:
+      return {};
+    case 'b':
+      base = 2;
+      break;
+    case 'o':
+      base = 8;
+      break;
+    case 'd':
+      break;
+    case 'x':
+      base = 16;
+      radix = 2;
+      exponent_point = 'p';
+      break;
+    case 'a':
+      base = radix = 36;
+      exponent_point = '^';
+      break;
+    case 's':
+      base = radix = 64;
+      exponent_point = '^';
+      break;
+    }
+    text.remove_prefix(2);
+  }
+
+  const auto valid = [base](string_view digits) {
+    return all_of(begin(digits), end(digits), [base](char c) {
+      return is_digit_separator(c) || digit_value(c, base) >= 0;
+    });
+  };
+
+  int64_t exponent = 0;
+  if (auto point = text.find(exponent_point); point != string_view::npos) {
+    auto digits = text.substr(point + 1);
+    text = text.substr(0, point);
+    const auto sign = !digits.empty() && (digits[0] == '-' || digits[0] == '+');
+    const auto negative_exponent = sign && digits[0] == '-';
+    digits.remove_prefix(sign);
+    if (digits.empty() || !valid(digits))
+      return {};
+    for (auto c : digits)
+      if (!is_digit_separator(c) &&
+          (exponent = exponent * base + digit_value(c, base)) > max_exponent)
+        return {};
+    if (negative_exponent)
+      exponent = -exponent;
+  }
+
+  const auto point = text.find('.');
+  const auto integer = text.substr(0, point);
+  const auto fraction =
+      point == string_view::npos ? string_view{} : text.substr(point + 1);
+  if (text.size() == (point != string_view::npos) || !valid(integer) ||
+      !valid(fraction))
+    return {};
+  return from_digits(negative, base, integer, fraction, radix, exponent);
+}
+
+Rational tonal::operator+(const Rational &l, const Rational &r) {
+  Rational sum;
+  auto a = l.numerator * r.denominator, b = r.numerator * l.denominator;
+  sum.denominator = l.denominator * r.denominator;
+  if (l.is_negative() == r.is_negative()) {
+    sum.negative = l.is_negative();
+    sum.numerator = move(a += b);
+  } else if (a < b) {
+    sum.negative = r.is_negative();
+    sum.numerator = move(b -= a);
+  } else {
+    sum.negative = l.is_negative();
+    sum.numerator = move(a -= b);
+  }
+  sum.reduce();
+  sum.negative = sum.is_negative();
+  return sum;
+}
+
+Rational tonal::operator*(const Rational &l, const Rational &r) {
+  Rational product;
+  product.numerator = l.numerator * r.numerator;
+  product.denominator = l.denominator * r.denominator;
+  product.reduce();
+  product.negative = l.is_negative() != r.is_negative() &&
+                     !product.numerator.is_zero();
+  return product;
+}
+
+/**
+ * Both are in lowest terms, and zero is equal to itself whatever its sign.
+ */
+bool tonal::operator==(const Rational &l, const Rational &r) {
+  return l.is_negative() == r.is_negative() && l.numerator == r.numerator &&
+         l.denominator == r.denominator;
+}
+
+bool tonal::operator<(const Rational &l, const Rational &r) {
+  if (l.is_negative() != r.is_negative())
+    return l.is_negative();
+  auto a = l.numerator * r.denominator, b = r.numerator * l.denominator;
+  return l.is_negative() ? b < a : a < b;
+}
+
+ostream &tonal::operator<<(ostream &out, const Rational &r) {
+  if (r.negative)
+    out << '-';
+  out << r.numerator;
+  if (!r.is_integer())
+    out << '/' << r.denominator;
+  return out;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Digit values run 0-9, then a-z from 10. Up to base 36 letters are case
+ * insensitive; base 64 continues with A-Z from 36, then + and \. -1 if c is
+ * not a digit of the base.
+ */
+int digit_value(char c, int base);
+
+/**
+ * ' and _ may separate digits anywhere in a number.
+ */
+inline bool is_digit_separator(char c) { return c == '\'' || c == '_'; }
+
+/**
+ * Exact natural number. Values that fit in 64 bits are held inline, larger
+ * ones as little-endian 32-bit limbs.
+ */
+class Natural {
+public:
+  Natural(uint64_t v = 0) : small(v) {}
+
+  bool is_small() const { return limbs.empty(); }
+  uint64_t value() const { return small; }
+  bool is_zero() const { return is_small() && !small; }
+
+  /**
+   * *this = *this * m + a
+   */
+  void multiply_add(uint32_t m, uint32_t a);
+
+  /**
+   * *this /= d, returning the remainder.
+   */
+  uint32_t divide(uint32_t d);
+  uint32_t remainder(uint32_t d) const;
+
+  Natural &operator+=(const Natural &r);
+
+  /**
+   * *this -= r, which must not be greater.
+   */
+  Natural &operator-=(const Natural &r);
+
+  friend Natural operator*(const Natural &l, const Natural &r);
+
+  friend bool operator==(const Natural &l, const Natural &r) {
+    return l.small == r.small && l.limbs == r.limbs;
+  }
+  friend bool operator!=(const Natural &l, const Natural &r) {
+    return !(l == r);
+  }
+  friend bool operator<(const Natural &l, const Natural &r);
+
+private:
+  void normalize();
+  vector<uint32_t> digits() const;
+
+  uint64_t small = 0;
+  vector<uint32_t> limbs;
+};
+
+Natural operator*(const Natural &, const Natural &);
+bool operator<(const Natural &, const Natural &);
+ostream &operator<<(ostream &, const Natural &);
+
+/**
+ * Exact rational number in lowest terms.
+ */
+class Rational {
+public:
+  bool negative = false;
+  Natural numerator;
+  Natural denominator = 1;
+
+  bool is_integer() const { return denominator == 1; }
+
+  /**
+   * Largest exponent magnitude folded into a number's exact value.
+   */
+  static constexpr int64_t max_exponent = 1 << 14;
+
+  /**
+   * integer.fraction * radix ^ exponent, with both parts written in base and
+   * holding only its digits and separators.
+   */
+  static Rational from_digits(bool negative, int base, string_view integer,
+                              string_view fraction, int radix,
+                              int64_t exponent);
+
+  /**
+   * A number spelled as the lexer reads it: an optional sign, an optional
+   * base prefix 0b, 0o, 0d, 0x, 0a or 0s, digits with at most one point,
+   * then an optional exponent after e, or p in base 16 and ^ in bases 36
+   * and 64, written in the same base. None if text is not one.
+   */
+  static optional<Rational> parse(string_view text);
+
+  /**
+   * Divides out common factors of 2, 3 and 5, the only primes in the bases
+   * and exponent radices the lexer accepts. Sums and products of such
+   * numbers bring in no others.
+   */
+  void reduce();
+
+  friend Rational operator+(const Rational &l, const Rational &r);
+  friend Rational operator*(const Rational &l, const Rational &r);
+  friend bool operator==(const Rational &l, const Rational &r);
+  friend bool operator<(const Rational &l, const Rational &r);
+
+private:
+  bool is_negative() const { return negative && !numerator.is_zero(); }
+};
+
+Rational operator+(const Rational &, const Rational &);
+Rational operator*(const Rational &, const Rational &);
+bool operator==(const Rational &, const Rational &);
+bool operator<(const Rational &, const Rational &);
+ostream &operator<<(ostream &, const Rational &);
+} // namespace tonal
@@ -0,0 +1,142 @@
+#include "overload.hpp"
+
+using namespace tonal;
+
+size_t OverloadResolver::KeyHash::operator()(const Key &key) const {
+  uint64_t h = key.set * 0x9e3779b97f4a7c15ull;
+  for (auto &argument : key.arguments)
+    h = (h ^ (uint64_t{argument.type} << 1 | argument.literal)) *
+        0x100000001b3ull;
+  return h ^ h >> 32;
+}
+
+uint32_t OverloadResolver::add_set(vector<Signature> signatures) {
+  vector<Candidate> set;
+  for (auto &signature : signatures) {
+    auto pack = signature.size();
+    for (size_t i = 0; i < signature.size() && pack == signature.size(); ++i)
+      if (signature[i].pack)
+        pack = i;
+    set.push_back({move(signature), pack});
+  }
+  sets.push_back(move(set));
+  return sets.size() - 1;
+}
+
+/**
+ * The parameter taking an argument, reading a pack as repeated enough times
+ * to take the arguments between the parameters around it. Null if there
+ * are too many arguments.
+ */
+const ParameterType *OverloadResolver::parameter(const Candidate &candidate,
+                                                 size_t argument,
+                                                 size_t arguments) {
+  const auto &parameters = candidate.parameters;
+  if (candidate.pack == parameters.size())
+    return argument < parameters.size() ? &parameters[argument] : nullptr;
+  const auto packed = arguments + 1 - parameters.size();
+  if (argument < candidate.pack)
+    return &parameters[argument];
+  if (argument < candidate.pack + packed)
+    return &parameters[candidate.pack];
+  return &parameters[argument + 1 - packed];
+}
+
+bool OverloadResolver::accepts(const ParameterType &parameter,
+                               const Argument &argument) {
+  if (parameter.literal && !argument.literal)
+    return false;
+  const auto name = parameter.constraint.concept;
+  if (lattice.is_class(name))
+    return argument.type == name ||
+           (argument.literal && lattice.converts(argument.type, name));
+  if (lattice.is_concept(name))
+    return lattice.satisfies(argument.type, parameter.constraint);
+  return true;
+}
+
+bool OverloadResolver::viable(const Candidate &candidate,
+                              const vector<Argument> &arguments) {
+  const auto size = candidate.parameters.size();
+  if (candidate.pack == size ? arguments.size() != size
+                             : arguments.size() + 1 < size)
+    return false;
+  for (size_t i = 0; i < arguments.size(); ++i)
+    if (!accepts(*parameter(candidate, i, arguments.size()), arguments[i]))
+      return false;
+  return true;
+}
+
+/**
+ * Compares two parameters that both accept the same argument.
+ */
+bool OverloadResolver::at_least_as_specific(const ParameterType &p,
+                                            const ParameterType &q) const {
+  if (p.pack && !q.pack)
+    return false;
+  if (q.literal && !p.literal)
+    return false;
+  const auto constraint = [this](const ParameterType &t) {
+    const auto name = t.constraint.concept;
+    return lattice.is_class(name) ? 2 : lattice.is_concept(name) ? 1 : 0;
+  };
+  const auto pc = constraint(p), qc = constraint(q);
+  if (pc != qc)
+    return pc > qc;
+  if (pc != 1)
+    return true;
+  if (p.constraint.concept != q.constraint.concept)
+    return lattice.refines(p.constraint.concept, q.constraint.concept);
+
+  /**
+   * The same concept is more specific with more of its arguments given.
+   */
+  const auto &pa = p.constraint.arguments, &qa = q.constraint.arguments;
+  for (size_t i = 0; i < qa.size(); ++i)
+    if (qa[i] && qa[i] != any && (i >= pa.size() || pa[i] != qa[i]))
+      return false;
+  return true;
+}
+
+uint32_t OverloadResolver::choose(const vector<Candidate> &set,
+                                  const vector<Argument> &arguments) {
+  vector<uint32_t> candidates;
+  for (uint32_t i = 0; i < set.size(); ++i)
+    if (viable(set[i], arguments))
+      candidates.push_back(i);
+  if (candidates.empty())
+    return no_match;
+
+  const auto dominates = [&](uint32_t a, uint32_t b) {
+    for (size_t i = 0; i < arguments.size(); ++i)
+      if (!at_least_as_specific(*parameter(set[a], i, arguments.size()),
+                                *parameter(set[b], i, arguments.size())))
+        return false;
+    return true;
+  };
+
+  /**
+   * Only the last survivor of a knockout can be the best; then check it.
+   */
+  auto best = candidates.front();
+  for (auto candidate : candidates)
+    if (!dominates(best, candidate))
+      best = candidate;
+  for (auto candidate : candidates)
+    if (candidate != best &&
+        (!dominates(best, candidate) || dominates(candidate, best)))
+      return ambiguous;
+  return best;
+}
+
+uint32_t OverloadResolver::resolve(uint32_t set,
+                                   const vector<Argument> &arguments) {
+  probe.set = set;
+  probe.arguments.assign(begin(arguments), end(arguments));
+  if (auto known = cache.find(probe); known != cache.end())
+    return known->second;
+  ++evaluated;
+  auto winner = choose(sets.at(set), arguments);
+  cache.emplace(probe, winner);
+  return winner;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "lattice.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * What a function parameter accepts, as in ((literal (integer false 32)) n).
+ * A constraint naming a class takes only that class, or a literal that
+ * converts to it, one naming a concept takes what satisfies it, and any
+ * other name, such as a template parameter, or none at all takes anything.
+ * A literal parameter takes only literal arguments, and a pack takes any
+ * number of arguments, including none.
+ */
+struct ParameterType {
+  Refinement constraint;
+  bool literal = false;
+  bool pack = false;
+};
+
+/**
+ * The type of an argument at a call: a class, or a literal pseudo-class
+ * from ConceptLattice::literal_type, and whether its value is a literal.
+ */
+struct Argument {
+  Atom type = 0;
+  bool literal = false;
+
+  friend bool operator==(const Argument &l, const Argument &r) {
+    return l.type == r.type && l.literal == r.literal;
+  }
+};
+
+/**
+ * Picks the best overload for a list of argument types.
+ *
+ * A candidate is viable if each argument is accepted by its parameter. A
+ * pack stands for as many parameters as the arguments need, worked out per
+ * position, so arguments are never copied to match it. The winner is the
+ * viable candidate at least as specific as every other at each position:
+ * a class over a concept, a concept over one it refines or over itself
+ * with fewer arguments given, anything over an unconstrained parameter, a
+ * literal parameter over a plain one and a single parameter over a pack.
+ * Without one the call is ambiguous.
+ *
+ * Answers are cached per (overload set, argument types), so checking a call
+ * again is one hash lookup.
+ */
+class OverloadResolver {
+public:
+  using Signature = vector<ParameterType>;
+
+  static constexpr uint32_t no_match = UINT32_MAX;
+  static constexpr uint32_t ambiguous = UINT32_MAX - 1;
+
+  explicit OverloadResolver(ConceptLattice &lattice) : lattice(lattice) {}
+
+  /**
+   * Registers an overload set and returns its id. Sets do not change once
+   * added.
+   */
+  uint32_t add_set(vector<Signature> signatures);
+
+  /**
+   * The index of the winning signature in the set, no_match or ambiguous.
+   */
+  uint32_t resolve(uint32_t set, const vector<Argument> &arguments);
+
+  /**
+   * Number of calls resolved rather than taken from the cache.
+   */
+  size_t evaluations() const { return evaluated; }
+
+private:
+  struct Candidate {
+    Signature parameters;
+    size_t pack; // Index of the pack, or parameters.size() if none
+  };
+
+  struct Key {
+    uint32_t set;
+    vector<Argument> arguments;
+    friend bool operator==(const Key &l, const Key &r) {
+      return l.set == r.set && l.arguments == r.arguments;
+    }
+  };
+
+  struct KeyHash {
+    size_t operator()(const Key &key) const;
+  };
+
+  static const ParameterType *parameter(const Candidate &candidate,
+                                        size_t argument, size_t arguments);
+  bool accepts(const ParameterType &parameter, const Argument &argument);
+  bool viable(const Candidate &candidate, const vector<Argument> &arguments);
+  bool at_least_as_specific(const ParameterType &p,
+                            const ParameterType &q) const;
+  uint32_t choose(const vector<Candidate> &set,
+                  const vector<Argument> &arguments);
+
+  ConceptLattice &lattice;
+  vector<vector<Candidate>> sets;
+  unordered_map<Key, uint32_t, KeyHash> cache;
+  Key probe; // Reused for lookups so hits do not allocate
+  Atom any = intern("any");
+  size_t evaluated = 0;
+};
+} // namespace tonal
@@ -0,0 +1,7 @@
+#include "prelude.hpp"
+
+#ifdef TONAL_EMPTY_PRELUDE
+const tonal::Prelude tonal::prelude{{}, {}, {}, nullptr, 0};
+#else
+#include "prelude.inc"
+#endif
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * lang.decl as lexed and parsed at build time by tonal -p. Every part is
+ * constant-initialized data in the executable. It is empty in the bootstrap
+ * build that generates it.
+ */
+struct Prelude {
+  string_view name;   // File name it was built from
+  string_view source; // Its text, with the '\n' the lexer sees appended
+  string_view tokens; // Token and list arenas in the token cache format
+  const string_view *interfaces; // One module interface per named module
+  size_t interface_count;
+};
+
+extern const Prelude prelude;
+} // namespace tonal
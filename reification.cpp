@@ -0,0 +1,134 @@
+#include "reification.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+using namespace tonal;
+
+namespace {
+/**
+ * Hash-consing table laid out like the atom table: argument lists are copied
+ * into an arena, instantiations are indexed by id in fixed blocks that never
+ * move, and the index is keyed by views into the arena. A lookup hashes the
+ * entity and argument ids, so it costs O(arguments) however deep they nest,
+ * and a repeated instantiation costs no memory.
+ */
+class ReificationTable {
+public:
+  ReificationTable() { add({0, 0, nullptr}); }
+
+  Reification reify(Atom entity, const vector<Reification> &arguments) {
+    if (arguments.size() > UINT32_MAX)
+      throw length_error{"Too many arguments"};
+    const Instantiation key{entity, static_cast<uint32_t>(arguments.size()),
+                            arguments.data()};
+    {
+      shared_lock lock{mutex};
+      if (auto found = index.find(key); found != index.end())
+        return found->second;
+    }
+    unique_lock lock{mutex};
+    if (auto found = index.find(key); found != index.end())
+      return found->second;
+    return add(key);
+  }
+
+  Instantiation instantiation(Reification reification) const {
+    return blocks[reification / block_size][reification % block_size];
+  }
+
+  size_t size() const {
+    shared_lock lock{mutex};
+    return count;
+  }
+
+private:
+  static constexpr size_t block_size = 4096, max_blocks = 1 << 16;
+  static constexpr size_t chunk_size = 1 << 14;
+
+  struct Hash {
+    size_t operator()(const Instantiation &i) const {
+      uint64_t h = i.entity * 0x9e3779b97f4a7c15ull ^ i.arity;
+      for (auto argument : i)
+        h = (h ^ argument) * 0x100000001b3ull;
+      return h ^ h >> 32;
+    }
+  };
+
+  struct Equal {
+    bool operator()(const Instantiation &l, const Instantiation &r) const {
+      return l.entity == r.entity && l.arity == r.arity &&
+             equal(l.begin(), l.end(), r.begin());
+    }
+  };
+
+  Reification add(Instantiation key) {
+    if (count == block_size * max_blocks)
+      throw length_error{"Too many reifications"};
+    auto &block = blocks[count / block_size];
+    if (!block)
+      block = make_unique<Instantiation[]>(block_size);
+    key.arguments = store(key);
+    block[count % block_size] = key;
+    index.emplace(key, count);
+    return count++;
+  }
+
+  const Reification *store(const Instantiation &key) {
+    if (!key.arity)
+      return nullptr;
+    if (key.arity > chunk_size / 4) {
+      chunks.push_back(make_unique<Reification[]>(key.arity));
+      copy(key.begin(), key.end(), chunks.back().get());
+      return chunks.back().get();
+    }
+    if (key.arity > chunk_left) {
+      chunks.push_back(make_unique<Reification[]>(chunk_size));
+      chunk_next = chunks.back().get();
+      chunk_left = chunk_size;
+    }
+    auto stored = chunk_next;
+    copy(key.begin(), key.end(), stored);
+    chunk_next += key.arity;
+    chunk_left -= key.arity;
+    return stored;
+  }
+
+  mutable shared_mutex mutex;
+  unordered_map<Instantiation, Reification, Hash, Equal> index;
+  unique_ptr<Instantiation[]> blocks[max_blocks];
+  vector<unique_ptr<Reification[]>> chunks;
+  Reification *chunk_next = nullptr;
+  size_t chunk_left = 0;
+  Reification count = 0;
+};
+
+ReificationTable &reification_table() {
+  static ReificationTable table;
+  return table;
+}
+} // namespace
+
+Reification tonal::reify(Atom entity, const vector<Reification> &arguments) {
+  return reification_table().reify(entity, arguments);
+}
+
+Instantiation tonal::instantiation(Reification reification) {
+  return reification_table().instantiation(reification);
+}
+
+string tonal::describe(Reification reification) {
+  const auto in = instantiation(reification);
+  if (!in.arity)
+    return string{spelling(in.entity)};
+  string out = "(" + string{spelling(in.entity)};
+  for (auto argument : in)
+    out += " " + describe(argument);
+  return out + ")";
+}
+
+size_t tonal::reification_count() { return reification_table().size(); }
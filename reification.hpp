@@ -0,0 +1,52 @@
+#pragma once
+
+#include "atom.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Dense id of an entity instantiated with arguments, such as
+ * (array uint8 32). Arguments are reifications themselves, a plain name or
+ * number being one with no arguments, so equal instantiations have equal ids
+ * however deeply nested. Reification 0 is the empty atom with no arguments.
+ * Ids are handed out in first-seen order and are not stable across runs.
+ */
+using Reification = uint32_t;
+
+/**
+ * An instantiation as stored. The arguments stay valid until the process
+ * exits.
+ */
+struct Instantiation {
+  Atom entity = 0;
+  uint32_t arity = 0;
+  const Reification *arguments = nullptr;
+
+  const Reification *begin() const { return arguments; }
+  const Reification *end() const { return arguments + arity; }
+};
+
+/**
+ * The one reification of entity with these arguments, made the first time
+ * it is asked for and shared by every module and file after that. Safe to
+ * call concurrently.
+ */
+Reification reify(Atom entity, const vector<Reification> &arguments = {});
+
+Instantiation instantiation(Reification reification);
+
+/**
+ * The instantiation as it would be written, as in (array uint8 32).
+ */
+string describe(Reification reification);
+
+/**
+ * Number of distinct instantiations so far.
+ */
+size_t reification_count();
+} // namespace tonal
@@ -0,0 +1,105 @@
+#include "searchorder.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace tonal;
+
+static uint64_t alias_key(SearchOrder::ScopeId scope, Atom name) {
+  return static_cast<uint64_t>(scope) << 32 | name;
+}
+
+SearchOrder::Node &SearchOrder::node(ScopeId scope) {
+  if (scope == no_scope || scope >= nodes.size())
+    throw out_of_range{"Scope not registered for search"};
+  return nodes[scope];
+}
+
+void SearchOrder::open(ScopeId scope, ScopeId parent) {
+  if (scope == no_scope)
+    throw invalid_argument{"Scope 0 is reserved"};
+  if (scope >= nodes.size())
+    nodes.resize(scope + 1);
+  nodes[scope] = {};
+  nodes[scope].parent = parent;
+  if (parent != no_scope)
+    node(parent).children.push_back(scope);
+}
+
+void SearchOrder::use(ScopeId scope, ScopeId space) {
+  auto &uses = node(scope).uses;
+  node(space);
+  if (find(begin(uses), end(uses), space) != end(uses))
+    return;
+  uses.push_back(space);
+  invalidate(scope);
+}
+
+void SearchOrder::unuse(ScopeId scope, ScopeId space) {
+  auto &uses = node(scope).uses;
+  if (auto used = find(begin(uses), end(uses), space); used != end(uses)) {
+    uses.erase(used);
+    invalidate(scope);
+  }
+}
+
+void SearchOrder::alias(ScopeId scope, Atom name, Alias target) {
+  node(scope);
+  aliases[alias_key(scope, name)] = target;
+}
+
+void SearchOrder::unalias(ScopeId scope, Atom name) {
+  aliases.erase(alias_key(scope, name));
+}
+
+optional<SearchOrder::Alias> SearchOrder::find_alias(ScopeId scope,
+                                                     Atom name) const {
+  if (auto alias = aliases.find(alias_key(scope, name));
+      alias != aliases.end())
+    return alias->second;
+  return {};
+}
+
+/**
+ * A cached order was built from its parent's, so if a scope's cache is
+ * already gone, so are its descendants' and the walk can stop there.
+ */
+void SearchOrder::invalidate(ScopeId scope) {
+  building.assign(1, scope);
+  while (!building.empty()) {
+    auto &n = nodes[building.back()];
+    building.pop_back();
+    if (!n.cached)
+      continue;
+    n.cached = false;
+    n.order.clear();
+    building.insert(end(building), begin(n.children), end(n.children));
+  }
+}
+
+const vector<SearchOrder::ScopeId> &SearchOrder::order(ScopeId scope) {
+  auto &n = node(scope);
+  if (n.cached)
+    return n.order;
+
+  vector<ScopeId> order{scope};
+  order.insert(end(order), begin(n.uses), end(n.uses));
+  if (n.parent != no_scope) {
+    const auto &inherited = this->order(n.parent);
+    order.insert(end(order), begin(inherited), end(inherited));
+  }
+  vector<ScopeId> seen;
+  auto last = remove_if(begin(order), end(order), [&seen](ScopeId s) {
+    if (find(begin(seen), end(seen), s) != end(seen))
+      return true;
+    seen.push_back(s);
+    return false;
+  });
+  order.erase(last, end(order));
+
+  auto &cached = nodes[scope];
+  cached.order = move(order);
+  cached.cached = true;
+  ++built;
+  return cached.order;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "atom.hpp"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Where a name is looked for from each lexical scope, and the aliases that
+ * `using` declares along the way. Scopes are numbered as in the symbol table
+ * and registered as they are opened.
+ *
+ * The order of a scope is the scope itself, then the namespaces it uses in
+ * the order they were used, then the order of its parent, each scope once.
+ * Using a namespace does not bring in what that namespace uses in turn.
+ * Orders are built on first request and kept until a use in the scope or
+ * one of its ancestors changes, which drops the cached orders of the whole
+ * subtree.
+ */
+class SearchOrder {
+public:
+  using ScopeId = uint32_t;
+  static constexpr ScopeId no_scope = 0;
+
+  /**
+   * A name that stands for another name looked up from another scope.
+   */
+  struct Alias {
+    ScopeId scope = no_scope;
+    Atom name = 0;
+  };
+
+  /**
+   * Registers a scope under its parent, or as a root.
+   */
+  void open(ScopeId scope, ScopeId parent = no_scope);
+
+  /**
+   * Adds or removes a namespace searched from scope after its own names.
+   */
+  void use(ScopeId scope, ScopeId space);
+  void unuse(ScopeId scope, ScopeId space);
+
+  /**
+   * Declares or removes name in scope as an alias. Aliases do not change any
+   * search order.
+   */
+  void alias(ScopeId scope, Atom name, Alias target);
+  void unalias(ScopeId scope, Atom name);
+  optional<Alias> find_alias(ScopeId scope, Atom name) const;
+
+  /**
+   * The memoized search order of a registered scope.
+   */
+  const vector<ScopeId> &order(ScopeId scope);
+
+  /**
+   * Number of orders built so far, for measuring the cache.
+   */
+  size_t builds() const { return built; }
+
+private:
+  struct Node {
+    ScopeId parent = no_scope;
+    vector<ScopeId> children, uses, order;
+    bool cached = false;
+  };
+
+  Node &node(ScopeId scope);
+  void invalidate(ScopeId scope);
+
+  vector<Node> nodes;
+  unordered_map<uint64_t, Alias> aliases;
+  vector<ScopeId> building;
+  size_t built = 0;
+};
+} // namespace tonal
@@ -0,0 +1,76 @@
+#include "source.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TONAL_MMAP
+#endif
+
+using namespace tonal;
+
+Source::Source(const string &path) {
+#ifdef TONAL_MMAP
+  /**
+   * The file is mapped over the front of an anonymous reservation one byte
+   * longer, so the appended '\n' lands either in the slack of the file's last
+   * page or in the reserved page after it. Both are private to this mapping.
+   */
+  if (auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC); fd >= 0) {
+    struct stat status;
+    if (fstat(fd, &status) == 0 && S_ISREG(status.st_mode) &&
+        status.st_size > 0) {
+      size_t length = status.st_size;
+      size_t page = sysconf(_SC_PAGESIZE);
+      size_t reserved = (length / page + 1) * page;
+      auto region = mmap(nullptr, reserved, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (region != MAP_FAILED &&
+          mmap(region, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+               fd, 0) != MAP_FAILED) {
+        auto text = static_cast<char *>(region);
+        text[length] = '\n';
+        mprotect(region, reserved, PROT_READ);
+        data = text;
+        size = length + 1;
+        mapped = reserved;
+      } else if (region != MAP_FAILED)
+        munmap(region, reserved);
+    }
+    close(fd);
+    if (mapped)
+      return;
+  }
+#endif
+
+  /**
+   * A file that cannot be opened reads as empty, without the '\n'.
+   */
+  if (ifstream stream{path, ios::binary}; stream) {
+    if (auto length = stream.seekg(0, ios::end).tellg(); length >= 0) {
+      contents.resize(length);
+      stream.seekg(0);
+      stream.read(&contents[0], length);
+      contents.resize(stream.gcount());
+    } else {
+      stream.clear();
+      ostringstream buffer;
+      buffer << stream.rdbuf();
+      contents = buffer.str();
+    }
+    contents += '\n';
+  }
+  data = contents.data();
+  size = contents.size();
+}
+
+Source::~Source() {
+#ifdef TONAL_MMAP
+  if (mapped)
+    munmap(const_cast<char *>(data), mapped);
+#endif
+}
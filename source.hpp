@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Read-only text of a source file with a '\n' appended after the last line.
+ * The file is mapped into memory where the platform allows and read in one
+ * go otherwise. Tokens view straight into the text, so it must outlive them.
+ */
+class Source {
+public:
+  explicit Source(const string &path);
+  Source(const Source &) = delete;
+  Source &operator=(const Source &) = delete;
+  ~Source();
+
+  string_view text() const { return {data, size}; }
+
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+  size_t mapped = 0;
+  string contents;
+};
+} // namespace tonal
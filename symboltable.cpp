@@ -0,0 +1 @@
+#include "symboltable.hpp"
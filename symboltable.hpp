@@ -1,18 +1,270 @@
 #pragma once
 
-#include "symboltable.hpp"
+#include "atom.hpp"
 
-#include "entity.hpp"
-#include "identifier.hpp"
-
-#include <memory>
-#include <unordered_map>
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace tonal {
+using namespace std;
+
+/**
+ * Names declared in nested lexical scopes, opened and closed in stack order
+ * as a file is parsed: module, concept, class, function and scope forms.
+ *
+ * Each (scope, name) pair has one slot in an open-addressed, linearly probed
+ * table. Its entries, the overload set, are chained through a flat vector in
+ * declaration order, so inserting never allocates per entry. A lookup makes
+ * one probe per level from the innermost scope out, and the first level
+ * declaring the name hides the rest. Entries only go into the innermost
+ * scope, which keeps each scope's entries at the back of the vector for
+ * pop_scope to drop.
+ *
+ * A scope closed with leave_scope instead keeps its names, which find_in
+ * reaches by scope id, for declarations that outlive the parse of their
+ * body. Scopes around a kept one cannot be popped.
+ */
+template <typename Entry> class SymbolTable {
+  static constexpr uint32_t none = UINT32_MAX;
+
+  struct Node {
+    Entry entry;
+    Atom name;
+    uint32_t next;
+  };
+
+public:
+  /**
+   * The entries declared under one name in one scope.
+   */
+  class Overloads {
+  public:
+    class iterator {
+    public:
+      using iterator_category = forward_iterator_tag;
+      using value_type = Entry;
+      using difference_type = ptrdiff_t;
+      using pointer = const Entry *;
+      using reference = const Entry &;
+
+      reference operator*() const { return (*nodes)[node].entry; }
+      pointer operator->() const { return &**this; }
+      iterator &operator++() {
+        node = (*nodes)[node].next;
+        return *this;
+      }
+      iterator operator++(int) {
+        auto i = *this;
+        ++*this;
+        return i;
+      }
+      friend bool operator==(const iterator &l, const iterator &r) {
+        return l.node == r.node;
+      }
+      friend bool operator!=(const iterator &l, const iterator &r) {
+        return l.node != r.node;
+      }
+
+    private:
+      friend class Overloads;
+      iterator(const vector<Node> *nodes, uint32_t node)
+          : nodes(nodes), node(node) {}
+
+      const vector<Node> *nodes = nullptr;
+      uint32_t node = none;
+    };
+
+    Overloads() = default;
+
+    iterator begin() const { return {nodes, first}; }
+    iterator end() const { return {nodes, none}; }
+    bool empty() const { return first == none; }
+    size_t size() const { return count; }
+
+    /**
+     * Nesting level of the scope that declared them, 0 being outermost. Not
+     * known to find_in, which gives 0.
+     */
+    size_t level() const { return depth; }
+
+  private:
+    friend class SymbolTable;
+    Overloads(const vector<Node> *nodes, uint32_t first, uint32_t count,
+              size_t depth)
+        : nodes(nodes), first(first), count(count), depth(depth) {}
+
+    const vector<Node> *nodes = nullptr;
+    uint32_t first = none, count = 0;
+    size_t depth = 0;
+  };
+
+  SymbolTable() : slots(16) {}
+
+  /**
+   * Opens a scope inside the current one and returns its id, never 0.
+   */
+  uint32_t push_scope() {
+    if (next_scope == none)
+      throw length_error{"Too many scopes"};
+    scopes.push_back({next_scope, static_cast<uint32_t>(nodes.size())});
+    return next_scope++;
+  }
+
+  /**
+   * Closes the innermost scope, forgetting what was declared in it.
+   */
+  void pop_scope() {
+    const auto [scope, mark] = scopes.back();
+    if (mark < kept)
+      throw logic_error{"Cannot pop a scope around a kept one"};
+    for (auto node = nodes.size(); node-- > mark;)
+      if (auto slot = find_slot(key(scope, nodes[node].name));
+          slot != none && slots[slot].first == node)
+        erase_slot(slot);
+    nodes.resize(mark);
+    scopes.pop_back();
+  }
+
+  /**
+   * Closes the innermost scope, keeping what was declared in it.
+   */
+  void leave_scope() {
+    kept = nodes.size();
+    scopes.pop_back();
+  }
+
+  /**
+   * Id of the innermost scope, or 0 if none is open.
+   */
+  uint32_t current() const { return scopes.empty() ? 0 : scopes.back().first; }
+
+  size_t depth() const { return scopes.size(); }
+  size_t size() const { return nodes.size(); }
+
+  /**
+   * Adds an entry under name to the innermost scope, after any already
+   * there.
+   */
+  void insert(Atom name, Entry entry) {
+    if (scopes.empty())
+      throw logic_error{"No scope to declare in"};
+    if (nodes.size() == none)
+      throw length_error{"Too many symbols"};
+    const auto node = static_cast<uint32_t>(nodes.size());
+    nodes.push_back({move(entry), name, none});
+
+    const auto k = key(scopes.back().first, name);
+    if (auto slot = find_slot(k); slot != none) {
+      nodes[slots[slot].last].next = node;
+      slots[slot].last = node;
+      ++slots[slot].count;
+      return;
+    }
+    if ((used + 1) * 2 > slots.size())
+      rehash(slots.size() * 2);
+    auto slot = home(k);
+    while (slots[slot].key)
+      slot = (slot + 1) & (slots.size() - 1);
+    slots[slot] = {k, node, node, 1};
+    ++used;
+  }
+
+  /**
+   * The overload set of name in the innermost scope that declares it, or an
+   * empty one.
+   */
+  Overloads find(Atom name) const {
+    for (auto level = scopes.size(); level-- > 0;)
+      if (auto slot = find_slot(key(scopes[level].first, name)); slot != none)
+        return {&nodes, slots[slot].first, slots[slot].count, level};
+    return {};
+  }
+
+  /**
+   * The overload set of name in a given open or kept scope.
+   */
+  Overloads find_in(uint32_t scope, Atom name) const {
+    auto slot = find_slot(key(scope, name));
+    return slot == none
+               ? Overloads{}
+               : Overloads{&nodes, slots[slot].first, slots[slot].count, 0};
+  }
+
+  /**
+   * The overload set of name in the innermost scope only.
+   */
+  Overloads find_local(Atom name) const {
+    if (scopes.empty())
+      return {};
+    auto slot = find_slot(key(scopes.back().first, name));
+    return slot == none ? Overloads{}
+                        : Overloads{&nodes, slots[slot].first,
+                                    slots[slot].count, scopes.size() - 1};
+  }
 
-struct SymbolTable {
 private:
-  unordered_multimap<Identifier, Entity> m_symbols;
-};
+  /**
+   * Key 0 marks an empty slot; scope ids start at 1 so no key is 0.
+   */
+  struct Slot {
+    uint64_t key;
+    uint32_t first, last, count;
+  };
+
+  static uint64_t key(uint32_t scope, Atom name) {
+    return static_cast<uint64_t>(scope) << 32 | name;
+  }
+
+  size_t home(uint64_t k) const {
+    return (k * 0x9e3779b97f4a7c15ull) >> 32 & (slots.size() - 1);
+  }
+
+  uint32_t find_slot(uint64_t k) const {
+    for (auto slot = home(k);; slot = (slot + 1) & (slots.size() - 1))
+      if (slots[slot].key == k)
+        return slot;
+      else if (!slots[slot].key)
+        return none;
+  }
 
+  /**
+   * Backward shift deletion: later slots of the same probe run move up so
+   * that no tombstones are needed.
+   */
+  void erase_slot(size_t hole) {
+    const auto mask = slots.size() - 1;
+    for (auto slot = (hole + 1) & mask; slots[slot].key;
+         slot = (slot + 1) & mask) {
+      auto wanted = home(slots[slot].key);
+      if (((slot - wanted) & mask) >= ((slot - hole) & mask)) {
+        slots[hole] = slots[slot];
+        hole = slot;
+      }
+    }
+    slots[hole] = {};
+    --used;
+  }
+
+  void rehash(size_t capacity) {
+    auto old = move(slots);
+    slots.assign(capacity, {});
+    for (auto &s : old)
+      if (s.key) {
+        auto slot = home(s.key);
+        while (slots[slot].key)
+          slot = (slot + 1) & (capacity - 1);
+        slots[slot] = s;
+      }
+  }
+
+  vector<Slot> slots;
+  size_t used = 0;
+  vector<Node> nodes;
+  vector<pair<uint32_t, uint32_t>> scopes; // Id and first node
+  uint32_t next_scope = 1;
+  size_t kept = 0; // Nodes below belong to kept scopes
+};
 } // namespace tonal
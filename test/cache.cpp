@@ -0,0 +1,88 @@
+#define main tonal_main
+#include "../tonal.cpp"
+#undef main
+
+namespace {
+int failures = 0;
+
+bool accepted(string_view text, string_view payload) {
+  TokenStore tokens;
+  vector<List> lists;
+  vector<ListHandle> owners;
+  return tokens.read(text, payload) &&
+         ParseState::read_lists(payload, tokens.size(), lists, owners);
+}
+
+void rejects(string_view text, const string &payload, const string &what) {
+  if (accepted(text, payload)) {
+    cerr << what << ": accepted\n";
+    ++failures;
+  }
+}
+} // namespace
+
+/**
+ * Corrupt token cache entries must miss, so that the file is lexed again
+ * rather than trusted. test/cache <directory> <file> checks entries for the
+ * file with each list link, owner and token type broken in turn, then
+ * stores one with every list link broken in the directory, for tonal to
+ * run over next. Prints what was accepted and exits with status 1 if
+ * anything was.
+ */
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    cerr << "test/cache <directory> <file>\n";
+    return 1;
+  }
+  const Source source{argv[2]};
+  const auto text = source.text();
+  const TokenStore tokens{text};
+  vector<List> lists;
+  vector<ListHandle> owners;
+  ParseState::index_lists(tokens, lists, owners);
+
+  string lexed;
+  tokens.write(lexed);
+  const auto entry = [&lexed](const vector<List> &lists,
+                              const vector<ListHandle> &owners) {
+    auto payload = lexed;
+    ParseState::write_lists(payload, lists, owners);
+    return payload;
+  };
+  if (!accepted(text, entry(lists, owners))) {
+    cerr << "An intact entry was rejected\n";
+    return 1;
+  }
+
+  constexpr ListHandle broken = 0x7fffffff;
+  for (ListHandle list = 0; list < lists.size(); ++list)
+    for (auto link : {&List::parent, &List::next})
+      for (auto to : {broken, list}) {
+        auto linked = lists;
+        linked[list].*link = to;
+        rejects(text, entry(linked, owners),
+                "List " + to_string(list) + " linked to " + to_string(to));
+      }
+  for (TokenHandle token = 0; token < owners.size(); ++token) {
+    auto owned = owners;
+    owned[token] = broken;
+    rejects(text, entry(lists, owned),
+            "Token " + to_string(token) + " owned by " + to_string(broken));
+  }
+
+  /**
+   * Types follow the line starts, each array after a 64-bit count.
+   */
+  const auto lines = count(cbegin(text), cend(text), '\n') + 1;
+  const auto types = 8 + 8 * lines + 8;
+  for (TokenHandle token = 0; token < tokens.size(); ++token) {
+    auto payload = entry(lists, owners);
+    payload[types + token] = 0x7f;
+    rejects(text, payload, "Token " + to_string(token) + " of no type");
+  }
+
+  for (auto &list : lists)
+    list.parent = list.next = broken;
+  TokenCache{argv[1]}.store(text, entry(lists, owners));
+  return failures ? 1 : 0;
+}
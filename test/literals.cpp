@@ -0,0 +1,77 @@
+#include "../token.hpp"
+
+#include <iostream>
+#include <sstream>
+
+using namespace tonal;
+
+namespace {
+int failures = 0;
+
+void fail(string_view text, const string &what) {
+  cerr << text << ": " << what << "\n";
+  ++failures;
+}
+
+/**
+ * text lexes as one number of the given value, and parses as the same.
+ */
+void accepts(string_view text, const Rational &expected) {
+  try {
+    TokenStream tokens{text};
+    auto token = tokens.begin();
+    const auto number = get_if<Token::Number>(&token->detail);
+    if (!number || token->region != text)
+      return fail(text, "does not lex as one number");
+    if (!(number->value == expected)) {
+      ostringstream out;
+      out << "lexes as " << number->value;
+      return fail(text, out.str());
+    }
+  } catch (const invalid_argument &e) {
+    return fail(text, e.what());
+  }
+  if (auto parsed = Rational::parse(text); !parsed || !(*parsed == expected))
+    fail(text, "parses otherwise");
+}
+
+/**
+ * text is a lexical error, and not a number to parse.
+ */
+void rejects(string_view text) {
+  try {
+    for (auto &&token : TokenStream{text})
+      static_cast<void>(token);
+    fail(text, "lexes");
+  } catch (const invalid_argument &) {
+  }
+  if (Rational::parse(text))
+    fail(text, "parses");
+}
+} // namespace
+
+/**
+ * Number literals the lexer must read, with their exact values, and ones it
+ * must reject. Prints what fails and exits with status 1 if anything does.
+ */
+int main() {
+  accepts("0", {false, 0, 1});
+  accepts("-0", {false, 0, 1});
+  accepts("42", {false, 42, 1});
+  accepts("-1.25", {true, 5, 4});
+  accepts("1'000_000", {false, 1000000, 1});
+  accepts("0b101.1e10", {false, 550, 1});
+  accepts("0x.8p-1", {false, 1, 4});
+  accepts("0xffffffffffffffff", {false, UINT64_MAX, 1});
+  accepts("0sA\\.+^-1", {false, 75775, 2048});
+  accepts("1e-3", {false, 1, 1000});
+
+  rejects("1..2");
+  rejects("0q1");
+  rejects("1e");
+  rejects("0b2");
+  rejects("1e99999");
+  rejects("0x");
+
+  return failures ? 1 : 0;
+}
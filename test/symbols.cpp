@@ -0,0 +1,106 @@
+#include "../symboltable.hpp"
+
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace tonal;
+
+namespace {
+int failures = 0;
+
+using Model = vector<vector<pair<Atom, int>>>;
+
+/**
+ * The entries under name in one scope of the model, in declaration order.
+ */
+vector<int> entries(const vector<pair<Atom, int>> &scope, Atom name) {
+  vector<int> found;
+  for (auto &[declared, entry] : scope)
+    if (declared == name)
+      found.push_back(entry);
+  return found;
+}
+
+template <typename Overloads>
+void expect(const Overloads &overloads, const vector<int> &expected,
+            size_t level, const string &what) {
+  const vector<int> found(begin(overloads), end(overloads));
+  if (found != expected || (!found.empty() && overloads.level() != level)) {
+    cerr << what << ": " << found.size() << " entries at level "
+         << overloads.level() << ", expected " << expected.size()
+         << " at level " << level << "\n";
+    ++failures;
+  }
+}
+
+/**
+ * Every name as find and find_local see it, against the model.
+ */
+void probe(const SymbolTable<int> &table, const Model &model,
+           const vector<Atom> &names, size_t step) {
+  for (auto name : names) {
+    const auto what = "Step " + to_string(step) + " " + string{spelling(name)};
+    auto level = model.size();
+    vector<int> expected;
+    while (level-- > 0 && (expected = entries(model[level], name)).empty())
+      ;
+    expect(table.find(name), expected, level, "find at " + what);
+    expect(table.find_local(name), entries(model.back(), name),
+           model.size() - 1, "find_local at " + what);
+  }
+}
+} // namespace
+
+/**
+ * Random pushes, inserts and pops on a small table, so that probe runs
+ * collide and popping shifts later slots back, checked after every step
+ * against a stack of scopes. Then checks that a kept scope's names stay
+ * reachable and that what surrounds it cannot be popped. Prints what fails
+ * and exits with status 1 if anything does.
+ */
+int main() {
+  vector<Atom> names;
+  for (int i = 0; i < 40; ++i)
+    names.push_back(intern("symbol" + to_string(i)));
+
+  SymbolTable<int> table;
+  Model model;
+  table.push_scope();
+  model.emplace_back();
+
+  mt19937 random{7};
+  for (size_t step = 0; step < 20000; ++step) {
+    const auto roll = random() % 8;
+    if (roll == 0 && model.size() < 12) {
+      table.push_scope();
+      model.emplace_back();
+    } else if (roll == 1 && model.size() > 1) {
+      table.pop_scope();
+      model.pop_back();
+    } else {
+      const auto name = names[random() % names.size()];
+      table.insert(name, static_cast<int>(step));
+      model.back().emplace_back(name, static_cast<int>(step));
+    }
+    probe(table, model, names, step);
+  }
+  while (model.size() > 1) {
+    table.pop_scope();
+    model.pop_back();
+  }
+  probe(table, model, names, 20000);
+
+  const auto kept = table.push_scope();
+  table.insert(names[0], -1);
+  table.leave_scope();
+  expect(table.find_in(kept, names[0]), {-1}, 0, "find_in a kept scope");
+  try {
+    table.pop_scope();
+    cerr << "Popped the scope around a kept one\n";
+    ++failures;
+  } catch (const logic_error &) {
+  }
+
+  return failures ? 1 : 0;
+}
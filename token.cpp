@@ -1,10 +1,14 @@
 #include "token.hpp"
+#include "cache.hpp"
 
+#include <algorithm>
+#include <array>
 #include <iostream>
+#include <limits>
 #include <numeric>
 #include <regex>
+#include <thread>
 #include <typeinfo>
-#include <unordered_map>
 
 #undef FALSE
 #undef INFINITY
@@ -23,7 +27,7 @@ template <typename T> COUT operator<<(COUT, const T &t) {
   return {};
 }
 
-static const unordered_map<string_view, Keyword> identifier2keyword = {
+static constexpr pair<string_view, Keyword> keywords[] = {
     /**
      * Declaration keywords
      */
@@ -40,6 +44,7 @@ static const unordered_map<string_view, Keyword> identifier2keyword = {
     {"list", Keyword::LIST},
     {"cast", Keyword::CAST},
     {"doc", Keyword::DOC},
+    {"using", Keyword::USING},
     /**
      * Flow control keywords
      */
@@ -87,6 +92,60 @@ static const unordered_map<string_view, Keyword> identifier2keyword = {
     {"this-byte", Keyword::THIS_BYTE},
 };
 
+/**
+ * Perfect hash over keywords: a seeded FNV-1a hash into a table of keyword
+ * indices, with the seed searched for at compile time so that no two
+ * keywords share a slot. Lookups hash once and compare one candidate.
+ */
+static constexpr size_t keyword_slots = 1024;
+static constexpr uint8_t no_keyword = numeric_limits<uint8_t>::max();
+
+static constexpr size_t keyword_length = [] {
+  size_t length = 0;
+  for (auto &keyword : keywords)
+    length = max(length, keyword.first.size());
+  return length;
+}();
+
+static constexpr uint32_t keyword_hash(string_view id, uint32_t seed) {
+  uint32_t hash = 2166136261u ^ seed;
+  for (auto c : id)
+    hash = (hash ^ static_cast<uint8_t>(c)) * 16777619u;
+  return hash % keyword_slots;
+}
+
+static constexpr uint32_t keyword_seed = [] {
+  for (uint32_t seed = 0;; ++seed) {
+    array<bool, keyword_slots> used{};
+    bool collision = false;
+    for (auto &keyword : keywords) {
+      auto &slot = used[keyword_hash(keyword.first, seed)];
+      collision |= slot;
+      slot = true;
+    }
+    if (!collision)
+      return seed;
+  }
+}();
+
+static constexpr auto keyword_table = [] {
+  array<uint8_t, keyword_slots> table{};
+  for (auto &slot : table)
+    slot = no_keyword;
+  for (size_t k = 0; k < size(keywords); ++k)
+    table[keyword_hash(keywords[k].first, keyword_seed)] = k;
+  return table;
+}();
+
+optional<Keyword> tonal::find_keyword(string_view id) {
+  if (id.empty() || id.size() > keyword_length)
+    return nullopt;
+  auto k = keyword_table[keyword_hash(id, keyword_seed)];
+  if (k == no_keyword || keywords[k].first != id)
+    return nullopt;
+  return keywords[k].second;
+}
+
 ostream &tonal::operator<<(ostream &out, const Token &token) {
   string indent(token.indent * 2, ' ');
   out << indent << token.detail.index() << ": ";
@@ -106,14 +165,14 @@ ostream &tonal::operator<<(ostream &out, const Token &token) {
           out << token.region << ": " << static_cast<int>(detail.keyword);
         } else if constexpr (is_same_v<Detail, Token::Identifier>) {
           if (detail.pack)
-            cout << "...";
+            out << "...";
           for (auto &&q : detail.qualified)
-            cout << q << " ";
-          cout << detail.id;
+            out << spelling(q) << " ";
+          out << spelling(detail.id);
           if (detail.unpack)
-            cout << "...";
+            out << "...";
         } else if constexpr (is_same_v<Detail, Token::Number>) {
-          cout << token.region << "\n"
+          out << token.region << "\n"
                << indent << "   Sign: " << detail.sign << "\n"
                << indent << "   Base: " << detail.base << "\n"
                << indent << "   Numerator: " << detail.numerator << "\n"
@@ -122,9 +181,10 @@ ostream &tonal::operator<<(ostream &out, const Token &token) {
                << indent << "   Exponent point: " << detail.exponent_point
                << "\n"
                << indent << "   Exponent sign: " << detail.exponent_sign << "\n"
-               << indent << "   Exponent: " << detail.exponent << "\n";
+               << indent << "   Exponent: " << detail.exponent << "\n"
+               << indent << "   Value: " << detail.value << "\n";
         } else if constexpr (is_same_v<Detail, Token::String>) {
-          cout << "\n"
+          out << "\n"
                << indent << "   Encoding: " << detail.encoding << "\n"
                << indent << "   Begin quote: " << detail.begin_quote << "\n"
                << indent << "   Begin delimiter: " << detail.begin_delimiter
@@ -145,38 +205,41 @@ ostream &tonal::operator<<(ostream &out, const Token &token) {
 
 Token::Token(string_view v) : region(v) {}
 
-bool matches(string_view v, const regex &r, cmatch &m) {
-  return regex_match(cbegin(v), cend(v), m, r,
-                     regex_constants::match_continuous);
+static size_t scan(string_view tokens, size_t pos);
+
+/**
+ * A token's source line runs up to the next token containing a newline, or to
+ * the end of the token if it contains one itself.
+ */
+static size_t line_end(string_view source, const Token &token) {
+  auto pos = token.pos + token.region.size();
+  if (token.region.find('\n') != string_view::npos)
+    return pos;
+  for (size_t length; pos < source.size(); pos += length)
+    if (length = scan(source, pos);
+        source.substr(pos, length).find('\n') != string_view::npos)
+      break;
+  return pos;
 }
 
 template <typename Exception>
-void report_error(const string &message, size_t pos,
-                  vector<Token>::const_iterator first,
-                  vector<Token>::const_iterator current,
-                  vector<Token>::const_iterator last) {
-  static const auto line_pred = [](const Token &t) {
-    return any_of(cbegin(t.region), cend(t.region),
-                  [](char c) { return c == '\n'; });
-  };
-  auto head =
-      max(find_if(reverse_iterator{current}, reverse_iterator{first}, line_pred)
-                  .base() -
-              1,
-          first);
-  auto line_end = max(find_if(current, last, line_pred) - 1, current);
-  auto start = cbegin(head->region) + head->region.rfind('\n') + 1;
-  string line = {start, cend(line_end->region)};
+void report_error(const string &message, size_t pos, string_view source,
+                  const Token &current) {
+  auto start = cbegin(source) + (current.pos - current.column);
+  string line = {start, cbegin(source) + line_end(source, current)};
   string arrow(line.size(), ' ');
-  auto token_start = distance(start, cbegin(current->region));
-  auto token_end = max(token_start, distance(start, cend(current->region)) - 1);
+  auto token_start = distance(start, cbegin(current.region));
+  auto token_end = max(token_start, distance(start, cend(current.region)) - 1);
   fill(begin(arrow) + token_start, begin(arrow) + token_end, '~');
   arrow[token_start] = arrow[token_end] = '+';
   pos += token_start;
+  if (pos >= arrow.size())
+    arrow.resize(pos + 1, ' ');
   arrow[pos] = '^';
-  string location = "Lexical error at line: " + to_string(current->line + 1) +
+  string location = "Lexical error at line: " + to_string(current.line + 1) +
                     ", column: " + to_string(pos + 1) + '\n';
-  equal(begin(arrow), end(arrow), cbegin(line), [](char &a, char l) {
+  equal(begin(arrow), begin(arrow) + line.size(), cbegin(line),
+        [](char &a, char l) {
     if (l == '\n')
       a = l;
     return true;
@@ -191,143 +254,145 @@ void report_error(const string &message, size_t pos,
   throw Exception{location + message + product};
 }
 
-static const regex pack_rx{R"(^\.\.\.(.*))"};
-static const regex unpack_rx{R"((.*)\.\.\.$)"};
+static bool is_alpha(char c) { return isalpha(static_cast<unsigned char>(c)); }
+static bool is_punct(char c) { return ispunct(static_cast<unsigned char>(c)); }
+static bool is_space(char c) { return isspace(static_cast<unsigned char>(c)); }
+static bool is_xdigit(char c) {
+  return isxdigit(static_cast<unsigned char>(c));
+}
+
 template <bool Pack = true, typename ReportLexicalError, typename TokenOffset>
 Token::Identifier
-validate_pack_unpack(cmatch match, ReportLexicalError &&report_lexical_error,
+validate_pack_unpack(string_view id, ReportLexicalError &&report_lexical_error,
                      TokenOffset &&token_offset) {
-  Token::Identifier t;
-  t.id = string_view(match[1].first, match[1].length());
-  t.pack = Pack;
-  t.unpack = !Pack;
-
-  auto offset = distance(match[0].first, match[1].first);
   string pack_unpack = Pack ? "pack" : "unpack";
-  if (auto idx = t.id.find('.'); idx != string_view::npos)
+  if (auto idx = id.find('.'); idx != string_view::npos)
     report_lexical_error("Period found in identifier " + pack_unpack + ":\n",
-                         idx + offset);
+                         token_offset(cbegin(id) + idx));
 
-  if (matches(t.id, regex{R"([^[:alpha:]_]+.*)"}, match))
+  if (!id.empty() && !is_alpha(id[0]) && id[0] != '_')
     report_lexical_error("Identifier " + pack_unpack +
                              " must begin with letters or underscore:\n",
-                         token_offset(match[0].first));
+                         token_offset(cbegin(id)));
 
-  if (identifier2keyword.find(t.id) != identifier2keyword.cend())
+  if (find_keyword(id))
     report_lexical_error("Identifier " + pack_unpack +
                              " cannot be a keyword:\n",
-                         token_offset(cbegin(t.id)));
+                         token_offset(cbegin(id)));
 
+  Token::Identifier t;
+  t.name = t.id = intern(id);
+  t.pack = Pack;
+  t.unpack = !Pack;
   return t;
 }
 
-static const regex number_rx{R"((-|\+)?(0[[:alpha:]])?(\.?)(.*))"};
 template <typename ReportLexicalError, typename TokenOffset>
-Token::Number validate_number(cmatch match,
+Token::Number validate_number(string_view number,
                               ReportLexicalError &&report_lexical_error,
                               TokenOffset &&token_offset) {
   Token::Number t;
-  t.sign = string_view(match[1].first, match[1].length());
-  t.base = string_view(match[2].first, match[2].length());
-  t.decimal_point = string_view(match[3].first, match[3].length());
-  t.numerator = string_view(match[4].first, match[4].length());
+  const auto slice = [&number](size_t length) {
+    auto s = number.substr(0, length);
+    number.remove_prefix(s.size());
+    return s;
+  };
+  t.sign = slice(number[0] == '-' || number[0] == '+');
+  t.base = slice(number.size() > 1 && number[0] == '0' && is_alpha(number[1])
+                     ? 2
+                     : 0);
+  t.decimal_point = slice(!number.empty() && number[0] == '.');
+  t.numerator = number;
 
   int base = 10;
+  int radix = 10;
   char exponent_point = 'e';
-  regex digits_rx{R"([^[:digit:]'_]+)"};
   if (t.base.length() > 1)
-    switch (*(cbegin(t.base) + 1)) {
+    switch (t.base[1]) {
     default:
       report_lexical_error("Unknown base:\n", token_offset(cbegin(t.base)) + 1);
       break;
     case 'b':
       base = 2;
-      digits_rx = R"([^01'_]+)";
       break;
     case 'o':
       base = 8;
-      digits_rx = R"([^0-7'_]+)";
       break;
     case 'd':
       base = 10;
-      digits_rx = R"([^[:digit:]'_]+)";
       break;
     case 'x':
       base = 16;
+      radix = 2;
       exponent_point = 'p';
-      digits_rx = R"([^[:xdigit:]'_]+)";
       break;
     case 'a':
-      base = 36;
+      base = radix = 36;
       exponent_point = '^';
-      digits_rx = R"([^[:alnum:]'_]+)";
       break;
     case 's':
-      base = 64;
+      base = radix = 64;
       exponent_point = '^';
-      digits_rx = R"([^[:alnum:]'_\\\+]+)";
       break;
     }
 
-  const auto validate_digits = [&digits_rx, &report_lexical_error,
+  const auto validate_digits = [base, &report_lexical_error,
                                 &token_offset](const string &aspect,
                                                const string_view &digits) {
-    cmatch nondigit_match;
-    if (regex_search(cbegin(digits), cend(digits), nondigit_match, digits_rx))
-      report_lexical_error("Illegal character found in " + aspect + ":\n",
-                           token_offset(nondigit_match[0].first));
+    for (auto &c : digits)
+      if (!is_digit_separator(c) && digit_value(c, base) < 0)
+        report_lexical_error("Illegal character found in " + aspect + ":\n",
+                             token_offset(&c));
   };
 
   const auto extract_exponent = [exponent_point, &report_lexical_error,
                                  &token_offset](string_view &v) {
-    cmatch exponent_match;
-    if (matches(v, regex{R"((.*?))"s + exponent_point + R"((-|\+)?(.*?))"},
-                exponent_match)) {
-      if (!exponent_match[3].length())
-        report_lexical_error("Exponent not found:\n",
-                             token_offset(exponent_match[1].second + 2));
-      v = string_view(exponent_match[1].first, exponent_match[1].length());
-      return make_tuple(
-          string_view(exponent_match[1].second, 1),
-          string_view(exponent_match[2].first, exponent_match[2].length()),
-          string_view(exponent_match[3].first, exponent_match[3].length()));
-    }
-    return make_tuple(string_view(exponent_match[0].first, 0),
-                      string_view(exponent_match[0].first, 0),
-                      string_view(exponent_match[0].first, 0));
+    auto point = v.find(exponent_point);
+    if (point == string_view::npos)
+      return make_tuple(v.substr(v.size()), v.substr(v.size()),
+                        v.substr(v.size()));
+    auto exponent = v.substr(point + 1);
+    auto sign = exponent.substr(
+        0, !exponent.empty() && (exponent[0] == '-' || exponent[0] == '+'));
+    exponent.remove_prefix(sign.size());
+    if (exponent.empty())
+      report_lexical_error("Exponent not found:\n",
+                           token_offset(cbegin(v) + point + 2));
+    auto exponent_point = v.substr(point, 1);
+    v = v.substr(0, point);
+    return make_tuple(exponent_point, sign, exponent);
   };
 
-  cmatch num;
-  if (!matches(t.numerator, regex{R"(([^\.]*)(\.?)([^\.]*?))"}, num))
+  auto point = t.numerator.find('.');
+  if (point != string_view::npos &&
+      t.numerator.find('.', point + 1) != string_view::npos)
     report_lexical_error("Number token does not match:\n",
                          token_offset(cbegin(t.numerator)));
-  if (!num[1].length() && !num[3].length())
+  if (t.numerator.size() == (point != string_view::npos))
     report_lexical_error("No digits found in number:\n",
-                         token_offset(num[1].first));
-  if (t.decimal_point.length() && num[2].length())
+                         token_offset(cbegin(t.numerator)));
+  if (t.decimal_point.length() && point != string_view::npos)
     report_lexical_error("Second decimal point found in number:\n",
-                         token_offset(num[2].first));
+                         token_offset(cbegin(t.numerator) + point));
 
-  if (t.decimal_point.empty())
-    t.decimal_point = string_view(num[2].first, num[2].length());
-
-  if (num[2].length()) {
-    t.numerator = string_view(num[1].first, num[1].length());
-    if (auto pos = find(cbegin(t.numerator), cend(t.numerator), exponent_point);
-        pos != num[1].second)
+  if (point != string_view::npos) {
+    t.decimal_point = t.numerator.substr(point, 1);
+    t.denominator = t.numerator.substr(point + 1);
+    t.numerator = t.numerator.substr(0, point);
+    if (auto pos = t.numerator.find(exponent_point); pos != string_view::npos)
       report_lexical_error("Exponent point found before decimal point:\n",
-                           token_offset(pos));
-
-    t.denominator = string_view(num[3].first, num[3].length());
+                           token_offset(cbegin(t.numerator) + pos));
     tie(t.exponent_point, t.exponent_sign, t.exponent) =
         extract_exponent(t.denominator);
   } else {
-    string_view numerominator(num[1].first, num[1].length());
+    if (t.decimal_point.empty())
+      t.decimal_point = t.numerator.substr(0, 0);
+    string_view numerominator = t.numerator;
     tie(t.exponent_point, t.exponent_sign, t.exponent) =
         extract_exponent(numerominator);
-    (match[3].length() ? t.denominator : t.numerator) = numerominator;
-    (match[3].length() ? t.numerator : t.denominator) =
-        string_view{cbegin(numerominator), 0};
+    (t.decimal_point.length() ? t.denominator : t.numerator) = numerominator;
+    (t.decimal_point.length() ? t.numerator : t.denominator) =
+        numerominator.substr(0, 0);
   }
 
   out << "Sign: " << t.sign << "\n";
@@ -342,42 +407,58 @@ Token::Number validate_number(cmatch match,
   out << "Exponent: " << t.exponent << "\n";
   validate_digits("exponent", t.exponent);
 
+  /**
+   * The exponent is written in the number's own base. Decimal exponents
+   * scale by 10, hexadecimal ones by 2 and base 36 and 64 ones by the base.
+   */
+  int64_t exponent = 0;
+  for (auto &c : t.exponent)
+    if (!is_digit_separator(c) &&
+        (exponent = exponent * base + digit_value(c, base)) >
+            Rational::max_exponent)
+      report_lexical_error("Exponent too large:\n", token_offset(&c));
+
+  t.value = Rational::from_digits(t.sign == "-", base, t.numerator,
+                                  t.denominator, radix,
+                                  t.exponent_sign == "-" ? -exponent
+                                                         : exponent);
+  out << "Value: " << t.value << "\n";
+
   return t;
 }
 
-static const regex string_rx{
-    R"(((u(\d+))(?:(R"|["'`]))|R"|["'`])((?:.|[[:cntrl:]])*))"};
 template <typename ReportLexicalError, typename TokenOffset>
-Token::String validate_string(cmatch match,
+Token::String validate_string(string_view str,
                               ReportLexicalError &&report_lexical_error,
                               TokenOffset &&token_offset) {
   Token::String t;
-  t.encoding = string_view(match[2].first, match[2].length());
-
-  string_view str(match[0].first, match[0].length());
-  int encoding = 8;
-  if (match[3].matched) {
-    if (match[3] == "8")
-      encoding = 8;
-    else if (match[3] == "16")
-      encoding = 16;
-    else if (match[3] == "32")
-      encoding = 32;
-    else
+  auto digits = str[0] == 'u' ? str.find_first_not_of("0123456789", 1) : 0;
+  t.encoding = str.substr(0, digits);
+
+  if (!t.encoding.empty()) {
+    auto encoding = t.encoding.substr(1);
+    if (encoding != "8" && encoding != "16" && encoding != "32")
       report_lexical_error("Unrecognized literal string encoding:\n",
-                           token_offset(match[3].first));
-    str.remove_prefix(match[2].length());
+                           token_offset(cbegin(encoding)));
+    str.remove_prefix(t.encoding.size());
   }
 
-  t.begin_quote = string_view(cbegin(str), 2);
-  t.end_quote = string_view(cend(str) - 1, 1);
+  auto raw = str[0] == 'R';
+  auto delimiter = raw ? str.find('(', 2) : 0;
+  if (delimiter == string_view::npos ||
+      str.size() < 2 * delimiter + (raw ? 1 : 2))
+    report_lexical_error("Unterminated string:\n",
+                         token_offset(cbegin(str)));
+
+  t.begin_quote = str.substr(0, 2);
+  t.end_quote = str.substr(str.size() - 1);
   str.remove_suffix(1);
   switch (str.front()) {
   case 'R':
     str.remove_prefix(2);
     {
-      auto delimiter = str.find('(') + 1;
-      t.begin_delimiter = string_view(cbegin(str), delimiter - 1);
+      delimiter -= 1;
+      t.begin_delimiter = str.substr(0, delimiter - 1);
       str.remove_suffix(delimiter);
       str.remove_prefix(delimiter);
       t.characters = str;
@@ -397,40 +478,54 @@ Token::String validate_string(cmatch match,
                            token_offset(cbegin(t.end_quote)));
     out << "Quoted string: " << str << "\n";
     t.characters = str;
-    static const regex escape_rx{
-        R"(\\x[[:xdigit:]]+|\\[0-7]{1,3}|\\u.{0,4}|\\U.{0,8}|\\.)"};
-    for_each(
-        regex_iterator{cbegin(str), cend(str), escape_rx}, {},
-        [&str, &report_lexical_error, &token_offset](cmatch match) {
-          string_view special(match[0].first + 2, match[0].length() - 2);
-          out << "Special: " << special << "\n";
-
-          const auto validate_unicode = [&str, &report_lexical_error,
-                                         &token_offset](const char *pos) {
-            report_lexical_error(
-                pos == cend(str)
-                    ? "Insufficient characters found for unicode literal:\n"
-                    : "Illegal character found in unicode literal:\n",
-                token_offset(pos));
-          };
-
-          auto hexcount = 0;
-          switch (match[0].first[1]) {
-          case 'u':
-            hexcount = 4;
-            break;
-          case 'U':
-            hexcount = 8;
-            break;
-          }
-
-          if (hexcount) {
-            regex_search(cbegin(special), cend(special), match,
-                         regex{R"([^[:xdigit:]])"});
-            if (distance(cbegin(special), match[0].first) < hexcount)
-              validate_unicode(match[0].first);
-          }
-        });
+    for (auto c = cbegin(str); c != cend(str); ++c) {
+      if (*c != '\\' || c + 1 == cend(str))
+        continue;
+      auto escape = c++;
+      size_t hexcount = 0;
+      switch (*c) {
+      case 'x':
+        while (c + 1 != cend(str) && is_xdigit(c[1]))
+          ++c;
+        break;
+      case '0':
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+        for (auto octal = 1; octal < 3 && c + 1 != cend(str) && c[1] >= '0' &&
+                             c[1] <= '7';
+             ++octal)
+          ++c;
+        break;
+      case 'u':
+        hexcount = 4;
+        break;
+      case 'U':
+        hexcount = 8;
+        break;
+      }
+
+      if (hexcount) {
+        auto special = c + 1;
+        auto last = special;
+        while (last != cend(str) && size_t(last - special) < hexcount &&
+               *last != '\n' && *last != '\r')
+          ++last;
+        auto digit = find_if_not(special, last, is_xdigit);
+        if (size_t(digit - special) < hexcount)
+          report_lexical_error(
+              digit == cend(str)
+                  ? "Insufficient characters found for unicode literal:\n"
+                  : "Illegal character found in unicode literal:\n",
+              token_offset(digit));
+        c = last - 1;
+      }
+      out << "Special: " << string_view(escape + 2, c - escape - 1) << "\n";
+    }
     break;
   }
   out << "Contents: " << str << "\n";
@@ -440,118 +535,319 @@ Token::String validate_string(cmatch match,
 
 template <typename ReportLexicalError, typename TokenOffset>
 variant<Token::Operator, Token::Keyword, Token::Identifier>
-validate_identifier(cmatch match, ReportLexicalError &&report_lexical_error,
+validate_identifier(string_view ident,
+                    ReportLexicalError &&report_lexical_error,
                     TokenOffset &&token_offset) {
-  string_view ident(match[0].first, match[0].length());
-  if (matches(ident, regex{R"([[:punct:]]+)"}, match)) {
-    if (regex_search(cbegin(ident), cend(ident), match, regex{R"(\.)"}))
+  if (all_of(cbegin(ident), cend(ident), is_punct)) {
+    if (auto dot = ident.find('.'); dot != string_view::npos)
       report_lexical_error("Period found in operator:\n",
-                           token_offset(match[0].first));
+                           token_offset(cbegin(ident) + dot));
     Token::Operator t;
     t.op = ident;
     return t;
   }
 
-  if (identifier2keyword.find(ident) != identifier2keyword.cend()) {
+  if (auto keyword = find_keyword(ident)) {
     Token::Keyword t;
-    t.keyword = identifier2keyword.at(ident);
+    t.keyword = *keyword;
     return t;
   }
 
-  if (regex_search(cbegin(ident), cend(ident), match, regex{R"(\.\.+)"}))
+  if (auto dots = ident.find(".."); dots != string_view::npos)
     report_lexical_error("Empty segment in qualified identifier:\n",
-                         token_offset(match[0].first) + 1);
-
-  static const regex sep_rx{R"(\.)"};
+                         token_offset(cbegin(ident) + dots) + 1);
+  if (ident.back() == '.')
+    report_lexical_error("Empty segment in qualified identifier:\n",
+                         token_offset(cend(ident) - 1));
 
-  Token::Identifier t;
-  transform(cregex_token_iterator{cbegin(ident), cend(ident), sep_rx, -1}, {},
-            back_inserter(t.qualified), [](const csub_match &sub) {
-              return string_view(sub.first, sub.length());
-            });
+  vector<string_view> segments;
+  for (auto segment = ident;;) {
+    auto dot = segment.find('.');
+    segments.push_back(segment.substr(0, dot));
+    if (dot == string_view::npos)
+      break;
+    segment.remove_prefix(dot + 1);
+  }
 
-  t.id = t.qualified.back();
-  for (const auto &segment : t.qualified) {
+  for (const auto &segment : segments) {
     out << "Identifier segment: " << segment << "\n";
-    cmatch match;
-    if (!matches(segment, regex{R"([[:alpha:]_].*)"}, match))
+    if (segment.empty() || (!is_alpha(segment[0]) && segment[0] != '_'))
       report_lexical_error("Identifier or identifier segment "
                            "must begin with a letter, underscore "
                            "or hyphen:\n",
                            token_offset(cbegin(segment)));
-    if (identifier2keyword.find(segment) != identifier2keyword.cend())
+    if (find_keyword(segment))
       report_lexical_error("Identifier segment cannot be a keyword:\n",
                            token_offset(cbegin(segment)));
-    if (matches(segment, regex{R"([[:punct:]]+)"}, match))
+    if (all_of(cbegin(segment), cend(segment), is_punct))
       report_lexical_error(
           "Operators not allowed as identifier or identifier segment:\n",
-          token_offset(match[0].first));
+          token_offset(cbegin(segment)));
   }
-  t.qualified.pop_back();
 
+  Token::Identifier t;
+  t.name = intern(ident);
+  t.id = segments.size() == 1 ? t.name : intern(segments.back());
+  segments.pop_back();
+  for (const auto &segment : segments)
+    t.qualified.push_back(intern(segment));
   return t;
 }
 
-void validate(vector<Token>::iterator first, vector<Token>::iterator last) {
-  for (auto next = first; next != last; ++next) {
-    Token &t = *next;
-
-    const auto report_lexical_error =
-        [&first, &next, &last](const string &message, size_t pos) {
-          report_error<invalid_argument>(message, pos, first, next, last);
-        };
-
-    const auto token_offset = [&t](const char *pos) {
-      return distance(cbegin(t.region), pos);
-    };
-
-    cmatch match;
-    if (t.region == "(") {
-      out << "List begin\n";
-      t.detail = Token::List{false, false};
-    } else if (t.region == ")") {
-      out << "List end\n";
-      t.detail = Token::List{true, false};
-    } else if (t.region == ")...") {
-      out << "List unpack\n";
-      t.detail = Token::List{true, true};
-    } else if (matches(t.region, pack_rx, match)) {
-      out << "Pack: " << match[1] << "\n";
-      t.detail =
-          validate_pack_unpack<true>(match, report_lexical_error, token_offset);
-    } else if (matches(t.region, unpack_rx, match)) {
-      out << "Unpack: " << match[1] << "\n";
-      t.detail = validate_pack_unpack<false>(match, report_lexical_error,
-                                             token_offset);
-    } else if (matches(t.region, regex{R"([[:punct:][^\(\)\.]]+)"}, match)) {
-      out << "Operator: " << t.region << "\n";
-      auto ident =
-          validate_identifier(match, report_lexical_error, token_offset);
-      visit([&t](auto &&ident) { t.detail = ident; }, ident);
-    } else if (matches(t.region,
-                       regex{R"(((-|\+)|(0[[:alpha:]])|\.|([[:digit:]]+?)).*)"},
-                       match)) {
-      out << "Number: " << t.region << "\n";
-      matches(t.region, number_rx, match);
-      t.detail = validate_number(match, report_lexical_error, token_offset);
-    } else if (matches(t.region, string_rx, match)) {
-      out << "String: " << t.region << "\n";
-      t.detail = validate_string(match, report_lexical_error, token_offset);
-    } else if (matches(t.region, regex{R"([^[:space:]\(\)]+)"}, match)) {
-      out << "Identifier: " << t.region << "\n";
-      auto ident =
-          validate_identifier(match, report_lexical_error, token_offset);
-      visit([&t](auto &&ident) { t.detail = ident; }, ident);
-    } else if (matches(t.region, regex{R"([[:space:]]+)"}, match)) {
-      out << "Whitespace\n";
-      t.detail = Token::Whitespace{};
-    } else
-      report_lexical_error("Unknown token:\n", 0);
-    t.pos = distance(cbegin(first->region), cbegin(t.region));
+static bool starts_string(string_view region) {
+  if (region[0] == 'u') {
+    auto digits = region.find_first_not_of("0123456789", 1);
+    if (digits == 1 || digits == string_view::npos)
+      return false;
+    region.remove_prefix(digits);
+  }
+  return region[0] == '"' || region[0] == '\'' || region[0] == '`' ||
+         (region.size() > 1 && region[0] == 'R' && region[1] == '"');
+}
+
+/**
+ * Classifies a token of source and fills in its details.
+ */
+void validate(Token &t, string_view source) {
+  const auto report_lexical_error = [&t, source](const string &message,
+                                                 size_t pos) {
+    report_error<invalid_argument>(message, pos, source, t);
+  };
+
+  const auto token_offset = [&t](const char *pos) {
+    return distance(cbegin(t.region), pos);
+  };
+
+  const auto &region = t.region;
+  const auto front = region.empty() ? '\0' : region.front();
+  if (region == "(") {
+    out << "List begin\n";
+    t.detail = Token::List{false, false};
+  } else if (region == ")") {
+    out << "List end\n";
+    t.detail = Token::List{true, false};
+  } else if (region == ")...") {
+    out << "List unpack\n";
+    t.detail = Token::List{true, true};
+  } else if (region.substr(0, 3) == "...") {
+    out << "Pack: " << region.substr(3) << "\n";
+    t.detail = validate_pack_unpack<true>(region.substr(3),
+                                          report_lexical_error, token_offset);
+  } else if (region.size() >= 3 && region.substr(region.size() - 3) == "...") {
+    out << "Unpack: " << region.substr(0, region.size() - 3) << "\n";
+    t.detail = validate_pack_unpack<false>(
+        region.substr(0, region.size() - 3), report_lexical_error,
+        token_offset);
+  } else if (!region.empty() && front != '"' && front != '\'' &&
+             front != '`' &&
+             all_of(cbegin(region), cend(region),
+                    [](char c) { return is_punct(c) && c != '.'; })) {
+    out << "Operator: " << region << "\n";
+    auto ident =
+        validate_identifier(region, report_lexical_error, token_offset);
+    visit([&t](auto &&ident) { t.detail = ident; }, ident);
+  } else if (front == '-' || front == '+' || front == '.' ||
+             (front >= '0' && front <= '9')) {
+    out << "Number: " << region << "\n";
+    t.detail = validate_number(region, report_lexical_error, token_offset);
+  } else if (starts_string(region)) {
+    out << "String: " << region << "\n";
+    t.detail = validate_string(region, report_lexical_error, token_offset);
+  } else if (!region.empty() && !is_space(front) && front != '(' &&
+             front != ')') {
+    out << "Identifier: " << region << "\n";
+    auto ident =
+        validate_identifier(region, report_lexical_error, token_offset);
+    visit([&t](auto &&ident) { t.detail = ident; }, ident);
+  } else if (!region.empty() && is_space(front)) {
+    out << "Whitespace\n";
+    t.detail = Token::Whitespace{};
+  } else
+    report_lexical_error("Unknown token:\n", 0);
+}
+
+/**
+ * Hand-written replacement for token_rx. Character classes come from a
+ * table, and each alternative of token_rx becomes a branch of the scanner
+ * below, tried in the same order with the same results.
+ */
+enum class CharClass : char { SPACE, OPEN, CLOSE, STRING, WORD };
+
+static constexpr auto char_class = [] {
+  array<CharClass, 256> table{};
+  for (auto &c : table)
+    c = CharClass::WORD;
+  for (unsigned char c : " \t\n\v\f\r"sv)
+    table[c] = CharClass::SPACE;
+  for (unsigned char c : "uR\"'`"sv)
+    table[c] = CharClass::STRING;
+  table['('] = CharClass::OPEN;
+  table[')'] = CharClass::CLOSE;
+  return table;
+}();
+
+static CharClass classify(char c) {
+  return char_class[static_cast<unsigned char>(c)];
+}
+
+/**
+ * Quoted strings: "(?:\\.|[^\"\n])*?" and friends. The regex tries the
+ * escape before the plain character, so the first path taking every escape
+ * wins if it reaches the closing quote. Otherwise the regex backtracks into
+ * the escapes, which is replayed here from the back of the line.
+ */
+static size_t scan_quoted(string_view tokens, size_t pos) {
+  const auto quote = tokens[pos];
+  const auto escapable = [tokens](size_t p) {
+    return tokens[p] == '\\' && p + 1 < tokens.size() &&
+           tokens[p + 1] != '\n' && tokens[p + 1] != '\r';
+  };
+
+  auto p = pos + 1;
+  for (; p < tokens.size() && tokens[p] != '\n'; ++p) {
+    if (tokens[p] == quote)
+      return p + 1;
+    if (escapable(p))
+      ++p;
+  }
+
+  const auto line_end = p;
+  vector<size_t> end(line_end - pos + 1, string_view::npos);
+  for (p = line_end; p-- > pos + 1;) {
+    auto &e = end[p - pos];
+    if (tokens[p] == quote)
+      e = p + 1;
+    else {
+      if (escapable(p))
+        e = end[p + 2 - pos];
+      if (e == string_view::npos)
+        e = end[p + 1 - pos];
+    }
+  }
+  return end[1];
+}
+
+/**
+ * Raw strings: R"delim(...)delim" with a delimiter of at most 16 characters
+ * that are not whitespace, backslashes or parentheses.
+ */
+static size_t scan_raw(string_view tokens, size_t pos) {
+  const auto first = pos + 2;
+  auto paren = first;
+  for (; paren < tokens.size() && paren - first <= 16; ++paren) {
+    const auto c = tokens[paren];
+    if (c == '(')
+      break;
+    if (classify(c) == CharClass::SPACE || c == '\\' || c == ')')
+      return string_view::npos;
+  }
+  if (paren == tokens.size() || paren - first > 16)
+    return string_view::npos;
+
+  const string terminator =
+      ')' + string{tokens.substr(first, paren - first)} + '"';
+  const auto end = tokens.find(terminator, paren + 1);
+  return end == string_view::npos ? end : end + terminator.size();
+}
+
+/**
+ * All string alternatives, including the u8/u16/u32 encoding prefix.
+ */
+static size_t scan_string(string_view tokens, size_t pos) {
+  const auto is_digit = [tokens](size_t p) {
+    return p < tokens.size() && tokens[p] >= '0' && tokens[p] <= '9';
+  };
+  if (tokens[pos] == 'u' && is_digit(pos + 1))
+    for (++pos; is_digit(pos);)
+      ++pos;
+  if (pos == tokens.size())
+    return string_view::npos;
+
+  switch (tokens[pos]) {
+  case 'R':
+    if (pos + 1 < tokens.size() && tokens[pos + 1] == '"')
+      return scan_raw(tokens, pos);
+    break;
+  case '"':
+  case '\'':
+  case '`':
+    return scan_quoted(tokens, pos);
+  }
+  return string_view::npos;
+}
+
+/**
+ * Returns the length of the token starting at pos.
+ */
+static size_t scan(string_view tokens, size_t pos) {
+  const auto run = [tokens, pos](auto &&pred) {
+    auto end = pos + 1;
+    while (end < tokens.size() && pred(classify(tokens[end])))
+      ++end;
+    return end - pos;
+  };
+
+  switch (classify(tokens[pos])) {
+  case CharClass::SPACE:
+    return run([](CharClass c) { return c == CharClass::SPACE; });
+  case CharClass::OPEN:
+    return 1;
+  case CharClass::CLOSE:
+    return tokens.substr(pos + 1, 3) == "..." ? 4 : 1;
+  case CharClass::STRING:
+    if (auto end = scan_string(tokens, pos); end != string_view::npos)
+      return end - pos;
+    [[fallthrough]];
+  case CharClass::WORD:
+    break;
   }
+  return run([](CharClass c) {
+    return c == CharClass::WORD || c == CharClass::STRING;
+  });
 }
 
-vector<Token> tonal::tokenize(string_view tokens) {
+/**
+ * Token metadata is accumulated in the same forward pass that splits the
+ * source. The column is measured from the start of the current line, which
+ * is tracked as newlines go by instead of searched for per token.
+ */
+void TokenCounters::measure(Token &t, string_view source) {
+  t.pos = distance(cbegin(source), cbegin(t.region));
+  t.token = tokens++;
+  t.column = t.pos - line_start;
+  for (auto c = t.region.find('\n'); c != string_view::npos;
+       c = t.region.find('\n', c + 1)) {
+    ++lines;
+    line_start = t.pos + c + 1;
+  }
+  t.line = lines;
+  const bool open = !t.region.empty() && t.region[0] == '(';
+  parens += open;
+  closes += !t.region.empty() && t.region[0] == ')';
+  t.paren = parens;
+  t.indent = parens - closes - open;
+}
+
+/**
+ * A run of the source lexed on its own. Counters start from zero and the
+ * columns of the chunk's first line are measured from first; tokenize()
+ * rebases them on the totals of the preceding chunks.
+ */
+struct Chunk {
+  size_t first = 0, last = 0, end = 0;
+  vector<Token> tokens;
+  TokenCounters counters;
+  size_t first_line = 0;
+  TokenCounters base;
+  exception_ptr error;
+};
+
+/**
+ * Splits [chunk.first, chunk.last) into tokens, finishing the last token
+ * even if it runs past chunk.last, and hands each measured token to emit.
+ */
+template <typename F>
+static void split(string_view tokens, Lexer lexer, Chunk &chunk, F &&emit) {
   static const regex token_rx{
       R"((?:u(?:\d+))?)" // String alternative encoding prefix
       /**/ R"((?:R"([^[:space:]\\\(\)]{0,16}?)\()" // Raw string delimiter
@@ -568,76 +864,393 @@ vector<Token> tonal::tokenize(string_view tokens) {
       R"(|[[:space:]]+)"             // Whitespace alternative
   };
 
-  vector<Token> parsed;
+  chunk.counters.line_start = chunk.first;
+  const auto push = [tokens, &chunk, &emit](string_view region) {
+    if (!chunk.counters.lines)
+      ++chunk.first_line;
+    Token t{region};
+    chunk.counters.measure(t, tokens);
+    emit(t);
+  };
 
-  transform(regex_iterator{cbegin(tokens), cend(tokens), token_rx}, {},
-            back_inserter(parsed), [](const cmatch &match) {
-              return string_view(match[0].first, match[0].length());
-            });
+  auto pos = chunk.first;
+  if (lexer == Lexer::REGEX)
+    for (regex_iterator match{cbegin(tokens) + pos, cend(tokens), token_rx};
+         pos < chunk.last && match != decltype(match){}; ++match) {
+      push(string_view((*match)[0].first, (*match)[0].length()));
+      pos += (*match)[0].length();
+    }
+  else
+    while (pos < chunk.last) {
+      auto length = scan(tokens, pos);
+      push(tokens.substr(pos, length));
+      pos += length;
+    }
+  chunk.end = pos;
+}
 
-  for (auto &t : parsed)
-    t.pos = distance(cbegin(tokens), cbegin(t.region));
+/**
+ * Runs f(i) for every chunk, one thread per chunk.
+ */
+template <typename F> void for_each_chunk(vector<Chunk> &chunks, F &&f) {
+  vector<thread> workers;
+  for (size_t i = 1; i < chunks.size(); ++i)
+    workers.emplace_back(f, i);
+  f(0);
+  for (auto &worker : workers)
+    worker.join();
+}
 
-  vector<int> token(parsed.size());
-  iota(begin(token), end(token), 0);
-  equal(begin(parsed), end(parsed), cbegin(token), [](Token &t, int token) {
-    t.token = token;
-    return true;
-  });
+/**
+ * Smallest run of source worth a thread of its own.
+ */
+static constexpr size_t min_chunk = 1 << 20;
 
-  vector<int> line_count;
-  transform(cbegin(parsed), cend(parsed), back_inserter(line_count),
-            [](const Token &t) {
-              return count(cbegin(t.region), cend(t.region), '\n');
-            });
-  partial_sum(cbegin(line_count), cend(line_count), begin(line_count));
-  equal(begin(parsed), end(parsed), cbegin(line_count), [](Token &t, int line) {
-    t.line = line;
-    return true;
+/**
+ * Chunks start at a whitespace run containing a newline, which is a token
+ * boundary unless it lies inside a raw string. There is one chunk per
+ * thread, or per core if threads is zero, but none smaller than min_chunk.
+ */
+static vector<Chunk> chunks_of(string_view tokens, unsigned threads) {
+  if (!threads)
+    threads = max(thread::hardware_concurrency(), 1u);
+  vector<Chunk> chunks(
+      max<size_t>(min<size_t>(threads, tokens.size() / min_chunk), 1));
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    auto boundary = min(tokens.find('\n', tokens.size() / chunks.size() * i),
+                        tokens.size());
+    while (boundary > chunks[i - 1].first &&
+           classify(tokens[boundary - 1]) == CharClass::SPACE)
+      --boundary;
+    chunks[i - 1].last = chunks[i].first = boundary;
+  }
+  chunks.back().last = tokens.size();
+  return chunks;
+}
+
+/**
+ * Runs lex(i) for every chunk on a thread each. Whether a chunk really
+ * started on a token boundary is only known once the preceding chunk has
+ * been lexed, so a chunk whose predecessor ran past its start is reset and
+ * lexed again from where the predecessor actually stopped. Each chunk's base
+ * then sums the counters of the chunks before it.
+ */
+template <typename F> static void lex_chunks(vector<Chunk> &chunks, F &&lex) {
+  for_each_chunk(chunks, lex);
+
+  for (size_t i = 1; i < chunks.size(); ++i) {
+    auto &chunk = chunks[i];
+    const auto &previous = chunks[i - 1];
+    if (chunk.first != previous.end) {
+      const auto last = max(chunk.last, previous.end);
+      chunk = Chunk{};
+      chunk.first = previous.end;
+      chunk.last = last;
+      lex(i);
+    }
+
+    chunk.base = previous.base;
+    chunk.base.tokens += previous.counters.tokens;
+    chunk.base.lines += previous.counters.lines;
+    chunk.base.parens += previous.counters.parens;
+    chunk.base.closes += previous.counters.closes;
+    if (previous.counters.lines)
+      chunk.base.line_start = previous.counters.line_start;
+  }
+}
+
+vector<Token> tonal::tokenize(string_view tokens, Lexer lexer,
+                              unsigned threads) {
+  auto chunks = chunks_of(tokens, lexer == Lexer::REGEX ? 1 : threads);
+  lex_chunks(chunks, [tokens, lexer, &chunks](size_t i) {
+    auto &chunk = chunks[i];
+    split(tokens, lexer, chunk, [&chunk](Token &t) {
+      chunk.tokens.push_back(move(t));
+    });
   });
 
-  vector<int> column_count;
-  transform(cbegin(parsed), cend(parsed), back_inserter(column_count),
-            [tokens](const Token &t) {
-              return distance(reverse_iterator{cbegin(t.region)},
-                              find(reverse_iterator{cbegin(t.region)},
-                                   reverse_iterator{cbegin(tokens)}, '\n'));
-            });
-  equal(begin(parsed), end(parsed), cbegin(column_count),
-        [](Token &t, int column) {
-          t.column = column;
-          return true;
-        });
-
-  vector<int> paren_count;
-  transform(cbegin(parsed), cend(parsed), back_inserter(paren_count),
-            [](const Token &t) {
-              if (t.region.empty())
-                return 0;
-              return t.region[0] == '(' ? 1 : 0;
-            });
-  partial_sum(cbegin(paren_count), cend(paren_count), begin(paren_count));
-  equal(begin(parsed), end(parsed), cbegin(paren_count),
-        [](Token &t, int paren) {
-          t.paren = paren;
-          return true;
-        });
-
-  vector<int> close_count;
-  transform(cbegin(parsed), cend(parsed), back_inserter(close_count),
-            [](const Token &t) {
-              if (t.region.empty())
-                return 0;
-              return t.region[0] == ')' ? -1 : 0;
-            });
-  partial_sum(cbegin(close_count), cend(close_count), begin(close_count));
-  equal(
-      begin(parsed), end(parsed), cbegin(close_count), [](Token &t, int close) {
-        t.indent = t.paren + close - (!t.region.empty() && t.region[0] == '(');
-        return true;
-      });
+  vector<Token> parsed(chunks.back().base.tokens +
+                       chunks.back().counters.tokens);
+  for_each_chunk(chunks, [&parsed, &chunks](size_t i) {
+    auto &chunk = chunks[i];
+    const auto &base = chunk.base;
+    auto out = begin(parsed) + base.tokens;
+    for (auto &t : chunk.tokens) {
+      if (static_cast<size_t>(t.token) < chunk.first_line)
+        t.column += chunk.first - base.line_start;
+      t.token += base.tokens;
+      t.line += base.lines;
+      t.paren += base.parens;
+      t.indent += base.parens - base.closes;
+      *out++ = move(t);
+    }
+    chunk.tokens = {};
+  });
 
-  validate(begin(parsed), end(parsed));
+  for_each_chunk(chunks, [tokens, &parsed, &chunks](size_t i) {
+    auto from = begin(parsed) + chunks[i].base.tokens;
+    auto to = i + 1 < chunks.size()
+                  ? begin(parsed) + chunks[i + 1].base.tokens
+                  : end(parsed);
+    try {
+      for_each(from, to, [tokens](Token &t) { validate(t, tokens); });
+    } catch (...) {
+      chunks[i].error = current_exception();
+    }
+  });
+  for (auto &chunk : chunks)
+    if (chunk.error)
+      rethrow_exception(chunk.error);
 
   return parsed;
 }
+
+TokenStream::TokenStream(string_view source) : source(source) {}
+
+bool TokenStream::next() {
+  if (pos == source.size())
+    return false;
+  auto length = scan(source, pos);
+  current = Token{source.substr(pos, length)};
+  counters.measure(current, source);
+  validate(current, source);
+  pos += length;
+  return true;
+}
+
+TokenStream::iterator TokenStream::begin() {
+  return ++iterator{this};
+}
+
+TokenStream::iterator TokenStream::end() { return {}; }
+
+TokenStore::TokenStore(string_view source, bool whitespace, unsigned threads)
+    : text(source) {
+  line_starts.push_back(0);
+  for (auto c = source.find('\n'); c != string_view::npos;
+       c = source.find('\n', c + 1))
+    line_starts.push_back(c + 1);
+
+  /**
+   * Each chunk is lexed and validated into a store of its own, which is
+   * appended here with its parens and indents rebased. Tokens are never all
+   * held in full: materializing them cost ten times the lexing itself.
+   */
+  auto chunks = chunks_of(source, threads);
+  auto streamed = chunks.size() == 1;
+  if (!streamed) {
+    vector<TokenStore> parts(chunks.size());
+    lex_chunks(chunks, [source, whitespace, &chunks, &parts](size_t i) {
+      parts[i] = TokenStore{};
+      try {
+        split(source, Lexer::SCANNER, chunks[i],
+              [source, whitespace, &part = parts[i]](Token &t) {
+                validate(t, source);
+                part.push_back(t, whitespace);
+              });
+      } catch (...) {
+        chunks[i].error = current_exception();
+      }
+    });
+    streamed = any_of(cbegin(chunks), cend(chunks),
+                      [](auto &chunk) { return !!chunk.error; });
+    const auto &last = chunks.back();
+    if (static_cast<uint64_t>(last.base.parens + last.counters.parens) >
+        numeric_limits<uint32_t>::max())
+      throw length_error{"Token or list count too large for a token store"};
+    if (!streamed)
+      for (size_t i = 0; i < parts.size(); ++i)
+        append(parts[i], chunks[i].base.parens, chunks[i].base.closes);
+  }
+
+  /**
+   * A source that does not split is streamed. So is one that failed to
+   * validate, whose chunks were measured from the wrong line: streaming
+   * reports the first error where the sequential lexer would.
+   */
+  if (streamed)
+    for (auto &&token : TokenStream{source})
+      push_back(token, whitespace);
+
+  line_starts.shrink_to_fit();
+  types.shrink_to_fit();
+  details.shrink_to_fit();
+  offsets.shrink_to_fit();
+  lengths.shrink_to_fit();
+  parens.shrink_to_fit();
+  indents.shrink_to_fit();
+  atoms.shrink_to_fit();
+}
+
+void TokenStore::push_back(const Token &token, bool whitespace) {
+  if (!whitespace &&
+      static_cast<TokenType>(token.detail.index()) == TokenType::WHITESPACE)
+    return;
+  types.push_back(static_cast<TokenType>(token.detail.index()));
+  details.push_back(visit(
+      [](auto &&detail) -> uint8_t {
+        using Detail = decay_t<decltype(detail)>;
+        if constexpr (is_same_v<Detail, Token::List>)
+          return (detail.end ? END : 0) | (detail.unpack ? UNPACK : 0);
+        else if constexpr (is_same_v<Detail, Token::Keyword>)
+          return static_cast<uint8_t>(detail.keyword);
+        else if constexpr (is_same_v<Detail, Token::Identifier>)
+          return (detail.pack ? PACK : 0) | (detail.unpack ? UNPACK : 0);
+        else
+          return 0;
+      },
+      token.detail));
+  if (token.region.size() > numeric_limits<uint32_t>::max() ||
+      static_cast<uint64_t>(token.paren) > numeric_limits<uint32_t>::max())
+    throw length_error{"Token or list count too large for a token store"};
+  offsets.push_back(token.pos);
+  lengths.push_back(token.region.size());
+  parens.push_back(token.paren);
+  indents.push_back(token.indent);
+  const auto ident = get_if<Token::Identifier>(&token.detail);
+  atoms.push_back(ident ? ident->name : 0);
+}
+
+void TokenStore::append(const TokenStore &part, int64_t opened,
+                        int64_t closed) {
+  types.insert(end(types), cbegin(part.types), cend(part.types));
+  details.insert(end(details), cbegin(part.details), cend(part.details));
+  offsets.insert(end(offsets), cbegin(part.offsets), cend(part.offsets));
+  lengths.insert(end(lengths), cbegin(part.lengths), cend(part.lengths));
+  for (auto paren : part.parens)
+    parens.push_back(paren + opened);
+  for (auto indent : part.indents)
+    indents.push_back(indent + opened - closed);
+  atoms.insert(end(atoms), cbegin(part.atoms), cend(part.atoms));
+}
+
+size_t TokenStore::line_index(size_t offset) const {
+  return distance(cbegin(line_starts), upper_bound(cbegin(line_starts),
+                                                   cend(line_starts), offset)) -
+         1;
+}
+
+int64_t TokenStore::line(size_t i) const {
+  return line_index(offsets[i] + lengths[i]);
+}
+
+int64_t TokenStore::column(size_t i) const {
+  return offsets[i] - line_starts[line_index(offsets[i])];
+}
+
+Token::List TokenStore::list(size_t i) const {
+  return {(details[i] & END) != 0, (details[i] & UNPACK) != 0};
+}
+
+Keyword TokenStore::keyword(size_t i) const {
+  return static_cast<Keyword>(details[i]);
+}
+
+Token::Identifier TokenStore::identifier(size_t i) const {
+  Token::Identifier t;
+  t.pack = details[i] & PACK;
+  t.unpack = details[i] & UNPACK;
+  t.name = t.id = atoms[i];
+  if (t.pack || t.unpack)
+    return t;
+  auto ident = spelling(t.name);
+  for (auto dot = ident.find('.'); dot != string_view::npos;
+       dot = ident.find('.')) {
+    t.qualified.push_back(intern(ident.substr(0, dot)));
+    ident.remove_prefix(dot + 1);
+  }
+  if (!t.qualified.empty())
+    t.id = intern(ident);
+  return t;
+}
+
+Token TokenStore::operator[](size_t i) const {
+  Token t{region(i)};
+  t.pos = pos(i);
+  t.token = i;
+  t.line = line(i);
+  t.column = column(i);
+  t.paren = paren(i);
+  t.indent = indent(i);
+  switch (type(i)) {
+  case TokenType::LIST:
+    t.detail = list(i);
+    break;
+  case TokenType::OPERATOR:
+    t.detail = Token::Operator{t.region};
+    break;
+  case TokenType::KEYWORD:
+    t.detail = Token::Keyword{keyword(i)};
+    break;
+  case TokenType::IDENTIFIER:
+    t.detail = identifier(i);
+    break;
+  case TokenType::NUMBER:
+  case TokenType::STRING:
+    validate(t, text);
+    break;
+  case TokenType::WHITESPACE:
+    break;
+  }
+  return t;
+}
+
+size_t TokenStore::bytes() const {
+  return (line_starts.capacity() + offsets.capacity()) * sizeof(uint64_t) +
+         types.capacity() * sizeof(TokenType) +
+         details.capacity() * sizeof(uint8_t) +
+         (lengths.capacity() + parens.capacity()) * sizeof(uint32_t) +
+         indents.capacity() * sizeof(int32_t) +
+         atoms.capacity() * sizeof(Atom);
+}
+
+void TokenStore::write(string &out) const {
+  write_array(out, line_starts);
+  write_array(out, types);
+  write_array(out, details);
+  write_array(out, offsets);
+  write_array(out, lengths);
+  write_array(out, parens);
+  write_array(out, indents);
+}
+
+bool TokenStore::read(string_view source, string_view &data) {
+  text = source;
+  if (!read_array(data, line_starts) || !read_array(data, types) ||
+      !read_array(data, details) || !read_array(data, offsets) ||
+      !read_array(data, lengths) || !read_array(data, parens) ||
+      !read_array(data, indents))
+    return false;
+
+  const auto count = types.size();
+  if (line_starts.empty() || line_starts.front() ||
+      line_starts.back() > source.size() ||
+      !is_sorted(cbegin(line_starts), cend(line_starts)) ||
+      details.size() != count || offsets.size() != count ||
+      lengths.size() != count || parens.size() != count ||
+      indents.size() != count)
+    return false;
+  for (size_t i = 0; i < count; ++i)
+    if (offsets[i] > source.size() ||
+        lengths[i] > source.size() - offsets[i] ||
+        static_cast<size_t>(types[i]) >=
+            variant_size_v<decltype(Token::detail)> ||
+        (types[i] == TokenType::KEYWORD &&
+         find_keyword(region(i)) != keyword(i)))
+      return false;
+
+  /**
+   * Interned as when lexed: packs and unpacks by their bare name.
+   */
+  atoms.assign(count, 0);
+  for (size_t i = 0; i < count; ++i)
+    if (types[i] == TokenType::IDENTIFIER) {
+      auto ident = region(i);
+      if (details[i] & PACK)
+        ident.remove_prefix(min<size_t>(3, ident.size()));
+      else if (details[i] & UNPACK)
+        ident.remove_suffix(min<size_t>(3, ident.size()));
+      atoms[i] = intern(ident);
+    }
+  return true;
+}
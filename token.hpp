@@ -1,5 +1,11 @@
 #pragma once
 
+#include "atom.hpp"
+#include "number.hpp"
+
+#include <cstdint>
+#include <iterator>
+#include <optional>
 #include <stdexcept>
 #include <string_view>
 #include <variant>
@@ -41,6 +47,7 @@ enum class Keyword : char {
   LIST,
   CAST,
   DOC,
+  USING,
   /**
    * Flow control keywords
    */
@@ -88,12 +95,17 @@ enum class Keyword : char {
   THIS_BYTE,
 };
 
+/**
+ * Keyword spelled by id, if any.
+ */
+optional<Keyword> find_keyword(string_view id);
+
 class Token {
 public:
   Token() = default;
   Token(string_view v);
 
-  int pos, token, line, column, paren, indent;
+  int64_t pos = 0, token = 0, line = 0, column = 0, paren = 0, indent = 0;
   string_view region;
 
   struct List {
@@ -109,9 +121,14 @@ public:
     tonal::Keyword keyword;
   };
 
+  /**
+   * Names are interned as they are lexed. For a.b.c, name is a.b.c, id is c
+   * and qualified is a, b. A pack or unpack has only its bare name.
+   */
   struct Identifier {
-    string_view id;
-    vector<string_view> qualified;
+    Atom name = 0;
+    Atom id = 0;
+    vector<Atom> qualified;
     bool pack = false;
     bool unpack = false;
   };
@@ -125,6 +142,7 @@ public:
     string_view exponent_point;
     string_view exponent_sign;
     string_view exponent;
+    Rational value;
   };
 
   struct String {
@@ -144,7 +162,164 @@ public:
 
 ostream &operator<<(ostream &, const Token &token);
 
-vector<Token> tokenize(string_view tokens);
+/**
+ * Running totals from which token metadata is derived while the source is
+ * split in order.
+ */
+struct TokenCounters {
+  int64_t tokens = 0, lines = 0, parens = 0, closes = 0;
+  size_t line_start = 0;
+
+  void measure(Token &token, string_view source);
+};
+
+/**
+ * Pull-based lexer producing the same tokens as tokenize(), one at a time.
+ * Only the current token and the running counters are kept, so memory does
+ * not grow with the source.
+ */
+class TokenStream {
+public:
+  class iterator {
+  public:
+    using iterator_category = input_iterator_tag;
+    using value_type = Token;
+    using difference_type = ptrdiff_t;
+    using pointer = Token *;
+    using reference = Token &;
+
+    reference operator*() const { return stream->current; }
+    pointer operator->() const { return &stream->current; }
+    iterator &operator++() {
+      if (!stream->next())
+        stream = nullptr;
+      return *this;
+    }
+    bool operator==(const iterator &i) const { return stream == i.stream; }
+    bool operator!=(const iterator &i) const { return stream != i.stream; }
+
+    TokenStream *stream = nullptr;
+  };
+
+  TokenStream(string_view source);
+
+  /**
+   * Lexes and validates the next token. Returns false at the end of the
+   * source.
+   */
+  bool next();
+  Token &token() { return current; }
+
+  iterator begin();
+  iterator end();
+
+private:
+  string_view source;
+  size_t pos = 0;
+  TokenCounters counters;
+  Token current;
+};
+
+/**
+ * Compact structure-of-arrays storage for the tokens of one source. A token
+ * costs its type tag, a detail byte (list flags, keyword or pack flags), a
+ * 64-bit offset and 32-bit length, paren and indent, so a source may be
+ * larger than 4 GiB but not one token in it, nor its count of lists. Lines
+ * are found from a table of line starts, and the components of
+ * identifiers, numbers and strings are decoded from the source only when
+ * asked for.
+ */
+class TokenStore {
+public:
+  TokenStore() = default;
+  /**
+   * Lexes the whole source, dropping whitespace tokens unless asked not to.
+   * A large source is lexed in chunks on up to `threads` threads, or one per
+   * core if zero, as tokenize() does.
+   */
+  explicit TokenStore(string_view source, bool whitespace = false,
+                      unsigned threads = 0);
+
+  size_t size() const { return types.size(); }
+  bool empty() const { return types.empty(); }
+  string_view source() const { return text; }
+
+  TokenType type(size_t i) const { return types[i]; }
+  string_view region(size_t i) const {
+    return text.substr(offsets[i], lengths[i]);
+  }
+  int64_t pos(size_t i) const { return offsets[i]; }
+  int64_t line(size_t i) const;
+  int64_t column(size_t i) const;
+  int64_t paren(size_t i) const { return parens[i]; }
+  int64_t indent(size_t i) const { return indents[i]; }
+
+  Token::List list(size_t i) const;
+  tonal::Keyword keyword(size_t i) const;
+  Token::Identifier identifier(size_t i) const;
+  /**
+   * The interned name of an identifier token, 0 for other tokens.
+   */
+  Atom atom(size_t i) const { return atoms[i]; }
+
+  /**
+   * Rebuilds the full token, decoding literal components on demand. The
+   * token number is the index in the store.
+   */
+  Token operator[](size_t i) const;
+
+  /**
+   * Heap bytes held by the store.
+   */
+  size_t bytes() const;
+
+  /**
+   * Appends the store to out in the token cache format, and reads it back
+   * over the same source. read consumes what it reads from data and returns
+   * false if it is malformed.
+   */
+  void write(string &out) const;
+  bool read(string_view source, string_view &data);
+
+private:
+  enum Flags : uint8_t { END = 1, UNPACK = 2, PACK = 4 };
+
+  void push_back(const Token &token, bool whitespace);
+  /**
+   * Appends a store lexed from a later chunk of the same source, rebasing
+   * its parens and indents on the lists opened and closed before it.
+   */
+  void append(const TokenStore &part, int64_t opened, int64_t closed);
+  size_t line_index(size_t offset) const;
+
+  string_view text;
+  vector<uint64_t> line_starts;
+  vector<TokenType> types;
+  vector<uint8_t> details;
+  vector<uint64_t> offsets;
+  vector<uint32_t> lengths, parens;
+  vector<int32_t> indents;
+  vector<Atom> atoms; // Not cached, atoms are per process
+};
+
+/**
+ * SCANNER is the table-driven lexer. REGEX is the original std::regex lexer,
+ * kept for diffing and benchmarking against the scanner.
+ */
+enum class Lexer : char { SCANNER, REGEX };
+
+/**
+ * Bumped whenever lexing, validation, the token store or the cache entry
+ * layout changes, which invalidates cached token streams.
+ */
+static constexpr uint32_t lexer_version = 4;
+
+/**
+ * Large sources are lexed and validated in chunks on up to `threads` threads,
+ * or one per core if zero. The result does not depend on the thread count.
+ */
+vector<Token> tokenize(string_view tokens, Lexer lexer = Lexer::SCANNER,
+                       unsigned threads = 0);
 } // namespace tonal
 
 /**
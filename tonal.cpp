@@ -1,49 +1,51 @@
 #include "tonal.hpp"
+#include "cache.hpp"
+#include "concurrent.hpp"
+#include "emitter.hpp"
+#include "evaluator.hpp"
+#include "lattice.hpp"
+#include "layout.hpp"
+#include "overload.hpp"
+#include "prelude.hpp"
+#include "reification.hpp"
+#include "searchorder.hpp"
+#include "source.hpp"
 #include "token.hpp"
+#include "vm.hpp"
 
 #include <algorithm>
+#include <array>
+#include <cstring>
 #include <experimental/filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <random>
 #include <regex>
+#include <set>
 #include <sstream>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 using namespace tonal;
 using namespace experimental;
 
-string read_file(ifstream stream) {
-  stringbuf source;
-  while (stream) {
-    stream.get(source);
-    source.sputc('\n');
-    stream.clear();
-    stream.get(); // .get does not extract \n
-  }
-  auto str = source.str();
-  return str;
-}
-
-template <typename T> vector<shared_ptr<T>> memory_sorted(size_t n) {
-  vector<shared_ptr<T>> sorted;
-  sorted.reserve(n);
-  generate_n(back_inserter(sorted), n, []() { return make_shared<T>(); });
-  sort(begin(sorted), end(sorted));
-  return sorted;
-}
-
-template <typename T> vector<shared_ptr<T>> memory_sorted(vector<T> &&v) {
-  auto sorted = memory_sorted<T>(v.size());
-  equal(begin(sorted), end(sorted), cbegin(v), [](auto &shared, auto &object) {
-    *shared = move(object);
-    return true;
-  });
-  return sorted;
-}
+/**
+ * Tokens and lists are addressed by their index in the ParseState of the file
+ * they come from. Both are numbered in source order.
+ */
+using TokenHandle = uint32_t;
+using ListHandle = uint32_t;
+static constexpr TokenHandle no_token = numeric_limits<TokenHandle>::max();
+static constexpr ListHandle no_list = numeric_limits<ListHandle>::max();
 
 class List;
 
@@ -53,79 +55,109 @@ class Parameter;
 
 class Id {
 public:
-  shared_ptr<const Token> location;
+  TokenHandle location = no_token;
+  Atom atom = 0;
+
+  friend bool operator==(const Id &l, const Id &r) { return l.atom == r.atom; }
 
   class Hash {
   public:
-    uint32_t operator()(const Id &id) const {
-      return hash<decltype(location)>{}(id.location);
-    }
+    size_t operator()(const Id &id) const { return id.atom; }
   };
 };
 
 class Variable {
 public:
-  shared_ptr<const Token> location;
+  TokenHandle location = no_token;
   vector<shared_ptr<Parameter>> parameters;
 };
 
-class ReturnType {};
+class ReturnType {
+public:
+  string_view type; // As written, before resolution
+  Reification reified = 0;
+};
 
 class Scope {
-  shared_ptr<const Token> location;
+  TokenHandle location = no_token;
 };
 
 class Function {
 public:
+  string_view name;
+  uint32_t scope = 0; // Symbol table scope of its body
   filesystem::path declaration_file;
-  shared_ptr<const Token> declaration;
+  TokenHandle declaration = no_token;
   filesystem::path description_file;
-  shared_ptr<const Token> description;
+  TokenHandle description = no_token;
   vector<shared_ptr<Variable>> captures;
   vector<shared_ptr<Parameter>> parameters;
   shared_ptr<ReturnType> return_type;
-  vector<shared_ptr<List>> body;
+  vector<ListHandle> body;
 };
 
 class Concept {
 public:
+  string_view name;
+  uint32_t scope = 0; // Symbol table scope of its members
   filesystem::path declaration_file;
-  shared_ptr<const Token> declaration;
+  TokenHandle declaration = no_token;
   filesystem::path description_file;
-  shared_ptr<const Token> description;
+  TokenHandle description = no_token;
   vector<shared_ptr<Parameter>> parameters;
   vector<shared_ptr<Concept>> bases;
+  vector<Refinement> refinements; // Bases as written, before resolution
   vector<shared_ptr<Function>> functions;
 };
 
 class Class {
 public:
+  string_view name;
+  uint32_t scope = 0; // Symbol table scope of its members
   filesystem::path declaration_file;
-  shared_ptr<const Token> declaration;
+  TokenHandle declaration = no_token;
   filesystem::path description_file;
-  shared_ptr<const Token> description;
+  TokenHandle description = no_token;
   vector<shared_ptr<Parameter>> parameters;
   vector<shared_ptr<Concept>> bases;
+  vector<Refinement> refinements; // Bases as written, before resolution
   vector<shared_ptr<Variable>> data;
   vector<shared_ptr<Function>> functions;
 };
 
 class Parameter {
 public:
-  shared_ptr<const Token> location;
+  TokenHandle location = no_token;
+  string_view spelling; // As written, before resolution
+  Atom name = 0;        // Last element, as bitsize in (number bitsize)
+  ParameterType accepts;
+  Reification reified = 0; // Of its type
   variant<shared_ptr<Concept>, shared_ptr<Class>, shared_ptr<Value>> type;
 };
 
+class ModuleInterface;
+
+/**
+ * Declarations are grouped into overload sets by name. An imported module
+ * starts with empty tables and fills a set in from its interface the first
+ * time the set is looked up.
+ */
 class Module {
 public:
-  multimap<filesystem::path, shared_ptr<const Token>> locations;
-  unordered_map<shared_ptr<const Id>, vector<shared_ptr<const Concept>>>
-      concepts;
-  unordered_map<shared_ptr<const Id>, vector<shared_ptr<const Class>>> classes;
-  unordered_map<shared_ptr<const Id>, vector<shared_ptr<const Function>>>
-      functions;
-  unordered_map<shared_ptr<const Id>, vector<shared_ptr<const Variable>>>
-      variables;
+  string name;
+  multimap<filesystem::path, TokenHandle> locations;
+  map<string, vector<shared_ptr<const Concept>>, less<>> concepts;
+  map<string, vector<shared_ptr<const Class>>, less<>> classes;
+  map<string, vector<shared_ptr<const Function>>, less<>> functions;
+  map<string, vector<shared_ptr<const Variable>>, less<>> variables;
+
+  shared_ptr<const ModuleInterface> interface;
+
+  template <typename T>
+  const vector<shared_ptr<const T>> &find(string_view name);
+
+private:
+  mutex lazy;
 };
 
 // class Entity {
@@ -136,12 +168,362 @@ public:
 class List : public Entity {
 public:
   List() = default;
-  List(const shared_ptr<Token> &h) { head = h; }
+  List(TokenHandle h) : head(h) {}
 
-  shared_ptr<const Token> head;
-  shared_ptr<const Token> tail;
+  TokenHandle head = no_token;
+  TokenHandle tail = no_token;
+  ListHandle parent = no_list;
+  ListHandle next = no_list; // Next sibling
 };
 
+/**
+ * Serialized interface of a module: its concept, class and function tables,
+ * with parameters and return types as written. The file is mapped and each
+ * overload set is decoded only when looked up. Strings view straight into
+ * the mapping, so decoded entities must not outlive the interface.
+ *
+ * All integers are 32-bit. After the header come, for concepts, classes and
+ * functions in turn, the overload sets sorted by name; then the entity
+ * records of each table, member functions following the functions table's
+ * own; then the parameter records; then the bases of concepts and classes,
+ * and their arguments; then the string bytes.
+ */
+class ModuleInterface {
+public:
+  enum Table { CONCEPTS, CLASSES, FUNCTIONS, TABLES };
+
+  struct Text {
+    uint32_t offset, size;
+  };
+
+  struct OverloadSet {
+    Text name;
+    uint32_t first, count;
+  };
+
+  struct EntityRecord {
+    Text name, file, return_type;
+    uint32_t declaration;
+    uint32_t first_parameter, parameters;
+    uint32_t first_function, functions;
+    uint32_t first_refinement, refinements;
+  };
+
+  struct ParameterRecord {
+    Text spelling, name;
+    uint32_t location;
+  };
+
+  struct RefinementRecord {
+    Text concept;
+    uint32_t first_argument, arguments;
+  };
+
+  struct Header {
+    char magic[8];
+    uint32_t version;
+    Text name;
+    uint32_t sets[TABLES], set_counts[TABLES];
+    uint32_t entities[TABLES], entity_counts[TABLES];
+    uint32_t parameters, parameter_count;
+    uint32_t refinements, refinement_count;
+    uint32_t arguments, argument_count;
+  };
+
+  static constexpr char magic[8] = {'t', 'o', 'n', 'a', 'l', 'm', 'i', 'f'};
+  static constexpr uint32_t version = 2;
+
+  /**
+   * Maps the interface; valid() is false if it is missing or malformed.
+   */
+  explicit ModuleInterface(const string &path)
+      : file(make_unique<const Source>(path)) {
+    load(file->text());
+  }
+
+  /**
+   * Reads an interface held in memory, which must outlive it.
+   */
+  explicit ModuleInterface(string_view bytes) { load(bytes); }
+
+  bool valid() const { return is_valid; }
+  string_view name() const { return text(header.name); }
+
+private:
+  void load(string_view bytes) {
+    data = bytes;
+    if (data.size() < sizeof(header))
+      return;
+    memcpy(&header, data.data(), sizeof(header));
+    if (!equal(begin(magic), end(magic), header.magic) ||
+        header.version != version)
+      return;
+    const auto fits = [this](uint32_t offset, uint64_t count, size_t size) {
+      return offset <= data.size() && count * size <= data.size() - offset;
+    };
+    for (auto table = 0; table < TABLES; ++table)
+      if (!fits(header.sets[table], header.set_counts[table],
+                sizeof(OverloadSet)) ||
+          !fits(header.entities[table], header.entity_counts[table],
+                sizeof(EntityRecord)))
+        return;
+    is_valid = fits(header.parameters, header.parameter_count,
+                    sizeof(ParameterRecord)) &&
+               fits(header.refinements, header.refinement_count,
+                    sizeof(RefinementRecord)) &&
+               fits(header.arguments, header.argument_count, sizeof(Text));
+  }
+
+public:
+  /**
+   * Decodes the overload set called name in the table of T, if any.
+   */
+  template <typename T>
+  vector<shared_ptr<const T>> find(string_view name) const {
+    constexpr auto table = is_same_v<T, Concept>
+                               ? CONCEPTS
+                               : is_same_v<T, Class> ? CLASSES : FUNCTIONS;
+    vector<shared_ptr<const T>> overloads;
+    uint32_t first = 0, last = header.set_counts[table];
+    while (first < last) {
+      auto middle = first + (last - first) / 2;
+      auto set = record<OverloadSet>(header.sets[table], middle);
+      if (auto order = text(set.name).compare(name); order < 0)
+        first = middle + 1;
+      else if (order > 0)
+        last = middle;
+      else {
+        for (auto i = set.first; i < set.first + set.count; ++i)
+          overloads.push_back(decode<T>(i));
+        break;
+      }
+    }
+    return overloads;
+  }
+
+  /**
+   * Serializes the module's concept, class and function tables. A non-empty
+   * file replaces the declaring file of every entity, so that interfaces
+   * built on one machine do not carry its paths.
+   */
+  static string write(const Module &module, string_view file = {}) {
+    string strings;
+    const auto add_text = [&strings](string_view s) {
+      Text t{static_cast<uint32_t>(strings.size()),
+             static_cast<uint32_t>(s.size())};
+      strings += s;
+      return t;
+    };
+
+    Header header{};
+    copy(begin(magic), end(magic), header.magic);
+    header.version = version;
+    header.name = add_text(module.name);
+
+    vector<OverloadSet> sets[TABLES];
+    vector<EntityRecord> entities[TABLES];
+    vector<ParameterRecord> parameters;
+    vector<RefinementRecord> refinements;
+    vector<Text> arguments;
+
+    const auto add_parameters = [&](auto &&entity, EntityRecord &record) {
+      record.first_parameter = parameters.size();
+      record.parameters = entity.parameters.size();
+      for (auto &parameter : entity.parameters)
+        parameters.push_back({add_text(parameter->spelling),
+                              add_text(spelling(parameter->name)),
+                              parameter->location});
+    };
+    const auto add_entity = [&](auto &&entity) {
+      EntityRecord record{};
+      record.name = add_text(entity.name);
+      record.file = file.empty()
+                        ? add_text(entity.declaration_file.u8string())
+                        : add_text(file);
+      record.declaration = entity.declaration;
+      add_parameters(entity, record);
+      using Entity = decay_t<decltype(entity)>;
+      if constexpr (is_same_v<Entity, Function>) {
+        if (entity.return_type)
+          record.return_type = add_text(entity.return_type->type);
+      } else {
+        record.first_refinement = refinements.size();
+        record.refinements = entity.refinements.size();
+        for (auto &base : entity.refinements) {
+          refinements.push_back(
+              {add_text(spelling(base.concept)),
+               static_cast<uint32_t>(arguments.size()),
+               static_cast<uint32_t>(base.arguments.size())});
+          for (auto argument : base.arguments)
+            arguments.push_back(add_text(spelling(argument)));
+        }
+      }
+      return record;
+    };
+    const auto add_sets = [&](Table table, auto &&overload_sets) {
+      for (auto &[name, overloads] : overload_sets) {
+        sets[table].push_back({add_text(name),
+                               static_cast<uint32_t>(entities[table].size()),
+                               static_cast<uint32_t>(overloads.size())});
+        for (auto &entity : overloads)
+          entities[table].push_back(add_entity(*entity));
+      }
+    };
+
+    add_sets(FUNCTIONS, module.functions);
+    const auto add_members = [&](Table table, auto &&overload_sets) {
+      add_sets(table, overload_sets);
+      auto record = begin(entities[table]);
+      for (auto &[name, overloads] : overload_sets)
+        for (auto &entity : overloads) {
+          record->first_function = entities[FUNCTIONS].size();
+          record->functions = entity->functions.size();
+          for (auto &function : entity->functions)
+            entities[FUNCTIONS].push_back(add_entity(*function));
+          ++record;
+        }
+    };
+    add_members(CONCEPTS, module.concepts);
+    add_members(CLASSES, module.classes);
+
+    string out(sizeof(header), '\0');
+    const auto append = [&out](auto &&records) {
+      auto offset = static_cast<uint32_t>(out.size());
+      out.append(reinterpret_cast<const char *>(records.data()),
+                 records.size() * sizeof(records[0]));
+      return offset;
+    };
+    for (auto table = 0; table < TABLES; ++table) {
+      header.sets[table] = append(sets[table]);
+      header.set_counts[table] = sets[table].size();
+    }
+    for (auto table = 0; table < TABLES; ++table) {
+      header.entities[table] = append(entities[table]);
+      header.entity_counts[table] = entities[table].size();
+    }
+    header.parameters = append(parameters);
+    header.parameter_count = parameters.size();
+    header.refinements = append(refinements);
+    header.refinement_count = refinements.size();
+    header.arguments = append(arguments);
+    header.argument_count = arguments.size();
+
+    /**
+     * Text offsets were taken within the string bytes, which go last.
+     */
+    const auto base = static_cast<uint32_t>(out.size());
+    const auto rebase = [base](auto *records, size_t count,
+                               auto... fields) {
+      for (size_t i = 0; i < count; ++i)
+        ((void)((records[i].*fields).offset += base), ...);
+    };
+    header.name.offset += base;
+    for (auto table = 0; table < TABLES; ++table) {
+      rebase(reinterpret_cast<OverloadSet *>(&out[header.sets[table]]),
+             sets[table].size(), &OverloadSet::name);
+      rebase(reinterpret_cast<EntityRecord *>(&out[header.entities[table]]),
+             entities[table].size(), &EntityRecord::name, &EntityRecord::file,
+             &EntityRecord::return_type);
+    }
+    rebase(reinterpret_cast<ParameterRecord *>(&out[header.parameters]),
+           parameters.size(), &ParameterRecord::spelling,
+           &ParameterRecord::name);
+    rebase(reinterpret_cast<RefinementRecord *>(&out[header.refinements]),
+           refinements.size(), &RefinementRecord::concept);
+    for (auto i = 0u; i < arguments.size(); ++i)
+      reinterpret_cast<Text *>(&out[header.arguments])[i].offset += base;
+    memcpy(&out[0], &header, sizeof(header));
+    return out + strings;
+  }
+
+private:
+  string_view text(Text t) const {
+    if (t.offset > data.size())
+      return {};
+    return data.substr(t.offset, t.size);
+  }
+
+  template <typename Record> Record record(uint32_t offset, size_t i) const {
+    Record r;
+    memcpy(&r, data.data() + offset + i * sizeof(Record), sizeof(r));
+    return r;
+  }
+
+  template <typename T> shared_ptr<T> decode(uint32_t i) const {
+    constexpr auto table = is_same_v<T, Concept>
+                               ? CONCEPTS
+                               : is_same_v<T, Class> ? CLASSES : FUNCTIONS;
+    if (i >= header.entity_counts[table])
+      throw out_of_range{"Corrupt module interface"};
+    auto r = record<EntityRecord>(header.entities[table], i);
+    auto entity = make_shared<T>();
+    entity->name = text(r.name);
+    entity->declaration_file = string{text(r.file)};
+    entity->declaration = r.declaration;
+    for (auto p = r.first_parameter;
+         p < r.first_parameter + r.parameters && p < header.parameter_count;
+         ++p) {
+      auto pr = record<ParameterRecord>(header.parameters, p);
+      auto parameter = make_shared<Parameter>();
+      parameter->spelling = text(pr.spelling);
+      parameter->name = intern(text(pr.name));
+      parameter->location = pr.location;
+      entity->parameters.push_back(parameter);
+    }
+    if constexpr (is_same_v<T, Function>) {
+      if (r.return_type.size) {
+        entity->return_type = make_shared<ReturnType>();
+        entity->return_type->type = text(r.return_type);
+      }
+    } else {
+      for (auto f = r.first_function; f < r.first_function + r.functions; ++f)
+        entity->functions.push_back(decode<Function>(f));
+      for (auto b = r.first_refinement;
+           b < r.first_refinement + r.refinements &&
+           b < header.refinement_count;
+           ++b) {
+        auto base = record<RefinementRecord>(header.refinements, b);
+        entity->refinements.push_back({intern(text(base.concept)), {}});
+        for (auto a = base.first_argument;
+             a < base.first_argument + base.arguments &&
+             a < header.argument_count;
+             ++a)
+          entity->refinements.back().arguments.push_back(
+              intern(text(record<Text>(header.arguments, a))));
+      }
+    }
+    return entity;
+  }
+
+  unique_ptr<const Source> file;
+  string_view data;
+  Header header{};
+  bool is_valid = false;
+};
+
+template <typename T>
+const vector<shared_ptr<const T>> &Module::find(string_view name) {
+  auto &table = [this]() -> auto & {
+    if constexpr (is_same_v<T, Concept>)
+      return concepts;
+    else if constexpr (is_same_v<T, Class>)
+      return classes;
+    else if constexpr (is_same_v<T, Function>)
+      return functions;
+    else
+      return variables;
+  }();
+
+  lock_guard lock{lazy};
+  if (auto set = table.find(name); set != table.end())
+    return set->second;
+  auto &set = table[string{name}];
+  if constexpr (!is_same_v<T, Variable>)
+    if (interface)
+      set = interface->find<T>(name);
+  return set;
+}
+
 class ParseState {
   class LexicalScope {
   public:
@@ -161,6 +543,11 @@ class ParseState {
         return &getScope();
     }
 
+    template <typename T> shared_ptr<T> pointer() const {
+      auto p = get_if<shared_ptr<T>>(&scope);
+      return p ? *p : nullptr;
+    }
+
     template <typename T>
     LexicalScope(T &&t) : scope(make_shared<decay_t<T>>(forward<T>(t))) {}
 
@@ -170,34 +557,37 @@ class ParseState {
         scope;
   };
 
+  /**
+   * Steps over the elements of a list, jumping over nested lists whole.
+   */
   class ListIterator {
   public:
-    bool at_head() const { return *iter == list->head; }
-    bool at_tail() const { return *iter == list->tail; }
+    bool at_head() const { return token == state->lists[list].head; }
+    bool at_tail() const { return token == state->lists[list].tail; }
 
-    const shared_ptr<const Token> &operator*() { return *iter; }
-    const Token *operator->() { return iter->get(); }
+    TokenHandle operator*() const { return token; }
 
     ListIterator &operator++() {
-      if (*iter != list->tail) {
-        ++iter;
-        while ((*iter)->indent > list->tail->indent + 1)
-          ++iter;
+      if (!at_tail()) {
+        if (auto owner = state->owners[token]; owner != list)
+          token = state->lists[owner].tail;
+        ++token;
       }
       return *this;
     }
 
     ListIterator &operator--() {
-      if (*iter != list->head) {
-        --iter;
-        while ((*iter)->indent > list->head->indent + 1)
-          --iter;
+      if (!at_head()) {
+        --token;
+        if (auto owner = state->owners[token]; owner != list)
+          token = state->lists[owner].head;
       }
       return *this;
     }
 
-    shared_ptr<const List> list;
-    vector<shared_ptr<const Token>>::const_iterator iter;
+    const ParseState *state;
+    ListHandle list;
+    TokenHandle token;
   };
 
   bool require_literal = false; // Also suppresses external linkage
@@ -218,6 +608,26 @@ class ParseState {
     const bool is_resetter = true;
   };
 
+  /**
+   * Opens a lexical scope in the symbol table for the life of the object.
+   * Its names are kept afterwards for lookups through the search order.
+   */
+  class SymbolScope {
+  public:
+    SymbolScope(ParseState &state)
+        : state(state), parent(state.symbols.current()),
+          id(state.symbols.push_scope()) {
+      state.search.open(id, parent);
+    }
+    ~SymbolScope() { state.symbols.leave_scope(); }
+
+  private:
+    ParseState &state;
+
+  public:
+    const uint32_t parent, id;
+  };
+
   template <typename D> class Declarator {
   public:
     Declarator(ParseState &state) : state(state) {
@@ -226,104 +636,568 @@ class ParseState {
     ~Declarator() { state.current_scope.pop_back(); }
 
     D *operator->() { return state.current_scope.back().template arrow<D>(); }
+    D &operator*() { return *operator->(); }
+    shared_ptr<D> get() {
+      return state.current_scope.back().template pointer<D>();
+    }
 
   private:
     ParseState &state;
   };
 
 public:
-  static map<filesystem::path, shared_ptr<const string>> sources;
-  static map<filesystem::path, shared_ptr<ParseState>> states;
-  static vector<shared_ptr<Module>> modules;
-
+  /**
+   * Shared by all files being compiled, which may be on different threads.
+   */
+  static ConcurrentMap<filesystem::path, shared_ptr<const Source>> sources;
+  static ConcurrentMap<filesystem::path, shared_ptr<ParseState>> states;
+  static TokenCache cache;
+
+  /**
+   * Modules loaded from interface files, by name, all of them before any
+   * file is compiled. Named modules declared by compiled files have their
+   * interfaces written to interface_directory when it is set.
+   */
+  static ConcurrentMap<string, shared_ptr<Module>> imports;
+  static string interface_directory;
+
+  /**
+   * The file's tokens and lists live in these arenas and are freed with the
+   * state. Whitespace tokens are not kept. Each token's owner is the list it
+   * opens or closes, or else the innermost list containing it.
+   */
   const filesystem::path path;
-  const vector<shared_ptr<const Token>> tokens;
-  const vector<shared_ptr<const List>> lists;
+  const TokenStore tokens;
+  const vector<List> lists;
+  const vector<ListHandle> owners;
+
+  /**
+   * Output for this file, printed in a fixed order once all files are done.
+   */
+  ostream &diagnostics;
 
+  vector<shared_ptr<Module>> modules; // Declared in this file, in order
   shared_ptr<Module> current_module;
   deque<LexicalScope> current_scope;
 
-  vector<shared_ptr<const List>> current_list;
-  vector<shared_ptr<const Token>> current_token;
-
-  ParseState(filesystem::path p, vector<shared_ptr<Token>> &&t,
-             vector<shared_ptr<List>> &&l)
-      : path(p), tokens(begin(t), end(t)), lists(begin(l), end(l)) {
+  /**
+   * Names visible at the point being parsed: the file's, then the current
+   * module's, then those of each enclosing declaration. An imported module
+   * has an empty scope of its own, looked up in the module instead.
+   */
+  using Declared =
+      variant<shared_ptr<const Concept>, shared_ptr<const Class>,
+              shared_ptr<const Function>>;
+  SymbolTable<Declared> symbols;
+  SearchOrder search;
+  unordered_map<Atom, uint32_t> module_scopes; // Imported or in this file
+  unordered_map<uint32_t, shared_ptr<Module>> imported_scopes;
+  vector<shared_ptr<Module>> imported_modules; // In search order
+  uint32_t module_scope = 0;
+
+  /**
+   * Concepts and classes of imported modules, such as the machine types of
+   * the prelude, that the file's declarations refine, hold or take, and the
+   * ones they refine in turn. The lattice and layouts see them as if the
+   * file declared them.
+   */
+  vector<shared_ptr<const Concept>> imported_concepts;
+  vector<shared_ptr<const Class>> imported_classes;
+
+  /**
+   * Refinements among the concepts and classes declared in this file.
+   */
+  ConceptLattice lattice;
+
+  /**
+   * Function overload sets seen at calls, by the functions in them. A set
+   * keeps its functions alive, so no key is ever reused for another set.
+   */
+  struct OverloadSet {
+    uint32_t id;
+    vector<shared_ptr<const Function>> functions;
+  };
+  OverloadResolver overloads{lattice};
+  map<vector<const Function *>, OverloadSet> overload_sets;
+
+  /**
+   * The function each call in a body binds to, by the call's list.
+   */
+  unordered_map<ListHandle, shared_ptr<const Function>> calls;
+
+  /**
+   * Literal expressions folded so far, shared by every instantiation of the
+   * templates in this file.
+   */
+  ConstantEvaluator constants;
+
+  /**
+   * Layouts of the classes declared in this file and of what they hold,
+   * by reification.
+   */
+  LayoutEngine layouts{constants};
+
+  vector<ListHandle> current_list;
+  vector<TokenHandle> current_token;
+
+  ParseState(filesystem::path p, TokenStore &&t, vector<List> &&l,
+             vector<ListHandle> &&o, ostream &d)
+      : path(p), tokens(move(t)), lists(move(l)), owners(move(o)),
+        diagnostics(d) {
     current_module = make_shared<Module>();
-    current_module->locations.emplace(p, nullptr);
+    current_module->locations.emplace(p, no_token);
     modules.push_back(current_module);
   }
 
-  static void compile(const filesystem::path &path) {
+  static void index_lists(const TokenStore &tokens, vector<List> &lists,
+                          vector<ListHandle> &owners) {
+    /**
+     * One pass with a stack of open lists links every list to its close,
+     * parent and next sibling. previous holds the last list opened at each
+     * depth, top level included.
+     */
+    lists.clear();
+    owners.clear();
+    owners.reserve(tokens.size());
+    vector<ListHandle> open, previous{no_list};
+    for (TokenHandle token = 0; token < tokens.size(); ++token) {
+      owners.push_back(open.empty() ? no_list : open.back());
+      if (tokens.type(token) != TokenType::LIST)
+        continue;
+      if (auto list = tokens.list(token); !list.end && !list.unpack) {
+        ListHandle opened = lists.size();
+        lists.emplace_back(token);
+        lists.back().parent = owners.back();
+        if (previous.back() != no_list)
+          lists[previous.back()].next = opened;
+        previous.back() = owners.back() = opened;
+        open.push_back(opened);
+        previous.push_back(no_list);
+      } else if (list.end && !open.empty()) {
+        lists[open.back()].tail = token;
+        open.pop_back();
+        previous.pop_back();
+      }
+    }
+    if (!open.empty()) {
+      auto head = lists[open.front()].head;
+      throw invalid_argument{"Unterminated list at line: " +
+                             to_string(tokens.line(head) + 1) + ", column: " +
+                             to_string(tokens.column(head) + 1)};
+    }
+  }
+
+  static void write_lists(string &out, const vector<List> &lists,
+                          const vector<ListHandle> &owners) {
+    vector<array<uint32_t, 4>> records;
+    records.reserve(lists.size());
+    for (auto &list : lists)
+      records.push_back({list.head, list.tail, list.parent, list.next});
+    write_array(out, records);
+    write_array(out, owners);
+  }
+
+  static bool read_lists(string_view data, size_t tokens, vector<List> &lists,
+                         vector<ListHandle> &owners) {
+    /**
+     * Lists are numbered by head, so a parent comes before its children and
+     * a next sibling after, and a token lies within its owner. Anything else
+     * would send a walk over the lists out of bounds or round in a cycle.
+     */
+    vector<array<uint32_t, 4>> records;
+    if (!read_array(data, records) || !read_array(data, owners) ||
+        owners.size() != tokens)
+      return false;
+    lists.clear();
+    for (ListHandle list = 0; list < records.size(); ++list) {
+      const auto [head, tail, parent, next] = records[list];
+      if (head >= tail || tail >= tokens ||
+          (parent != no_list && parent >= list) ||
+          (next != no_list && (next <= list || next >= records.size())))
+        return false;
+      lists.emplace_back(head);
+      lists.back().tail = tail;
+      lists.back().parent = parent;
+      lists.back().next = next;
+    }
+    for (TokenHandle token = 0; token < tokens; ++token)
+      if (const auto owner = owners[token];
+          owner != no_list &&
+          (owner >= lists.size() || token < lists[owner].head ||
+           token > lists[owner].tail))
+        return false;
+    return true;
+  }
+
+  /**
+   * Compiles a file unless it has been already. Safe to call concurrently.
+   */
+  static void compile(const filesystem::path &path, ostream &diagnostics) {
     const auto full_path = canonical(absolute(path));
-    sources[full_path] =
-        make_shared<string>(read_file(ifstream{full_path.u8string()}));
-
-    auto file_tokens = tokenize(*sources[full_path]);
-    file_tokens.erase(
-        remove_if(begin(file_tokens), end(file_tokens), [](auto &token) {
-          return static_cast<TokenType>(token.detail.index()) ==
-                 TokenType::WHITESPACE;
-        }));
-    // for (auto &t : file_tokens)
-    //   if (t.detail.index() != static_cast<char>(TokenType::WHITESPACE))
-    //     cout << t << "\n";
-
-    auto tokens = memory_sorted(move(file_tokens));
-
-    vector<List> list_tokens;
-    copy_if(
-        cbegin(tokens), cend(tokens), back_inserter(list_tokens),
-        [](auto &&token) {
-          bool copy = false;
-          visit(
-              [&copy](auto &&detail) {
-                if constexpr (is_same_v<Token::List, decay_t<decltype(detail)>>)
-                  copy = !detail.end && !detail.unpack;
-              },
-              token->detail);
-          return copy;
-        });
-
-    auto lists = memory_sorted(move(list_tokens));
-    for (auto &&list : lists)
-      list->tail =
-          *find_if(lower_bound(cbegin(tokens), cend(tokens), list->head),
-                   cend(tokens), [&list](auto &&token) {
-                     bool found = false;
-                     visit(
-                         [&found](auto &&detail) {
-                           if constexpr (is_same_v<Token::List,
-                                                   decay_t<decltype(detail)>>)
-                             found = detail.end;
-                         },
-                         token->detail);
-                     return found && list->head->indent == token->indent;
-                   });
-
-    (states[full_path] =
-         make_shared<ParseState>(full_path, move(tokens), move(lists)))
-        ->parse_file();
-  }
-
-  const shared_ptr<const List> &
-  find_list(const shared_ptr<const Token> &token) const {
-    return *lower_bound(
-        cbegin(lists), cend(lists), token, [](auto &&l, auto &&r) {
-          using L = decay_t<decltype(*l)>;
-          using R = decay_t<decltype(*r)>;
-          static_assert(is_same_v<L, List> || is_same_v<R, List>);
-          if constexpr (is_same_v<L, List>)
-            return l->head < r;
-          else if constexpr (is_same_v<R, List>)
-            return l < r->head;
-        });
-  }
-
-  ListIterator iterate_list(const shared_ptr<const List> &list) {
+    auto source = make_shared<const Source>(full_path.u8string());
+    if (!sources.insert(full_path, source))
+      return;
+
+    /**
+     * A warm cache skips lexing and list indexing. Only files that lex and
+     * index cleanly are cached.
+     */
+    const auto text = source->text();
+    TokenStore tokens;
+    vector<List> lists;
+    vector<ListHandle> owners;
+    if (!cache.find(text, [&](string_view data) {
+          return tokens.read(text, data) &&
+                 read_lists(data, tokens.size(), lists, owners);
+        })) {
+      tokens = TokenStore{text};
+      if (tokens.size() >= no_token)
+        throw length_error{"Too many tokens in " + full_path.u8string()};
+      index_lists(tokens, lists, owners);
+
+      string payload;
+      tokens.write(payload);
+      write_lists(payload, lists, owners);
+      cache.store(text, payload);
+    }
+
+    auto state = make_shared<ParseState>(full_path, move(tokens), move(lists),
+                                         move(owners), diagnostics);
+    states.insert(full_path, state);
+    state->parse_file();
+
+    if (!interface_directory.empty())
+      for (auto &module : state->modules)
+        if (!module->name.empty())
+          write_interface(*module);
+  }
+
+  /**
+   * Writes <interface_directory>/<module name>.tmi. The file is replaced
+   * whole, so concurrent importers never see a partial interface.
+   */
+  static void write_interface(const Module &module) {
+    filesystem::create_directories(interface_directory);
+    const auto path = interface_directory + '/' + module.name + ".tmi";
+    const auto salt =
+        hash<thread::id>{}(this_thread::get_id()) ^ random_device{}();
+    const auto temporary = path + '.' + to_string(salt) + ".tmp";
+    {
+      const auto bytes = ModuleInterface::write(module);
+      ofstream out{temporary, ios::binary | ios::trunc};
+      if (!out.write(bytes.data(), bytes.size()).flush()) {
+        out.close();
+        remove(temporary.c_str());
+        throw runtime_error{"Cannot write module interface " + path};
+      }
+    }
+    if (rename(temporary.c_str(), path.c_str())) {
+      remove(temporary.c_str());
+      throw runtime_error{"Cannot write module interface " + path};
+    }
+  }
+
+  /**
+   * Registers the prelude built into the executable. Its tokens and lists
+   * are copied out of the binary and its modules imported straight from it,
+   * so nothing is read or lexed.
+   */
+  static void load_prelude() {
+    if (prelude.source.empty())
+      return;
+    TokenStore tokens;
+    vector<List> lists;
+    vector<ListHandle> owners;
+    auto data = prelude.tokens;
+    if (!tokens.read(prelude.source, data) ||
+        !read_lists(data, tokens.size(), lists, owners))
+      throw logic_error{"Corrupt prelude"};
+
+    auto state = make_shared<ParseState>(
+        filesystem::path{string{prelude.name}}, move(tokens), move(lists),
+        move(owners), cerr);
+    for (auto i = 0u; i < prelude.interface_count; ++i) {
+      auto module = make_shared<Module>();
+      module->interface = make_shared<const ModuleInterface>(
+          prelude.interfaces[i]);
+      module->name = module->interface->name();
+      state->modules.push_back(module);
+      imports.insert(module->name, module);
+    }
+    states.insert(state->path, state);
+  }
+
+  /**
+   * Writes the tables of a compiled file as C++ for prelude.cpp: its source,
+   * its token and list arenas and an interface for each named module.
+   */
+  static void write_prelude(const filesystem::path &file,
+                            const string &output) {
+    auto state = states.find(canonical(absolute(file)));
+    if (!state)
+      throw invalid_argument{"No prelude compiled from " + file.u8string()};
+
+    const auto literal = [](string_view bytes) {
+      ostringstream out;
+      out << "std::string_view{";
+      for (size_t i = 0; i < bytes.size(); i += 16) {
+        out << "\n    \"" << hex;
+        for (auto c : bytes.substr(i, 16))
+          out << "\\x" << setw(2) << setfill('0')
+              << static_cast<unsigned>(static_cast<unsigned char>(c));
+        out << '"' << dec;
+      }
+      out << (bytes.empty() ? "\"\", " : ",\n    ") << bytes.size() << "}";
+      return out.str();
+    };
+
+    const auto name = file.filename().u8string();
+    string tokens;
+    state->tokens.write(tokens);
+    write_lists(tokens, state->lists, state->owners);
+    vector<string> interfaces;
+    for (auto &module : state->modules)
+      if (!module->name.empty())
+        interfaces.push_back(ModuleInterface::write(*module, name));
+
+    ostringstream out;
+    out << "// Generated from " << name << " by tonal -p. Do not edit.\n\n";
+    if (!interfaces.empty()) {
+      out << "namespace {\nconstexpr std::string_view interfaces[] = {";
+      for (auto &interface : interfaces)
+        out << literal(interface) << ',';
+      out << "};\n} // namespace\n\n";
+    }
+    out << "const tonal::Prelude tonal::prelude{" << literal(name) << ",\n    "
+        << literal(state->tokens.source()) << ",\n    " << literal(tokens)
+        << ",\n    "
+        << (interfaces.empty()
+                ? "nullptr, 0"
+                : "interfaces, sizeof(interfaces) / sizeof(*interfaces)")
+        << "};\n";
+
+    ofstream file_out{output, ios::trunc};
+    if (!(file_out << out.str()).flush())
+      throw runtime_error{"Cannot write prelude " + output};
+  }
+
+  /**
+   * Runs a function of a compiled file on the bytecode machine with no
+   * arguments, printing what it yields and returns. Functions with a
+   * (do ...) body are lowered as the run reaches them.
+   */
+  static void run(const filesystem::path &file, string_view name,
+                  ostream &out) {
+    auto state = states.find(canonical(absolute(file)));
+    if (!state)
+      throw invalid_argument{"Nothing compiled from " + file.u8string()};
+    VirtualMachine vm{state->bodies()};
+    state->add_classes(vm);
+    const auto function = intern(name);
+    if (!vm.is_generator(function, 0)) {
+      const auto result = vm.call(function, {});
+      out << "RETURN: " << result << "\n";
+      return;
+    }
+    auto generator = vm.start(function, {});
+    while (auto value = generator.resume())
+      out << "YIELD: " << *value << "\n";
+    out << "RETURN: " << generator.result() << "\n";
+  }
+
+  /**
+   * Writes a function of a compiled file, and what it calls, as a C++
+   * program that prints what run() would. Classes of the file, and the
+   * imported ones it uses, with a machine type map to it; those of the file
+   * with data and no template parameters are written as structs.
+   */
+  static void emit(const filesystem::path &file, string_view name,
+                   const string &output) {
+    auto state = states.find(canonical(absolute(file)));
+    if (!state)
+      throw invalid_argument{"Nothing compiled from " + file.u8string()};
+    CppEmitter emitter{state->bodies(), state->layouts};
+    state->add_classes(emitter);
+    for (auto &module : state->modules)
+      for (auto &[type_name, classes] : module->classes)
+        for (auto &type : classes)
+          if (type->parameters.empty())
+            emitter.add_struct(reify(intern(type_name)));
+    ofstream file_out{output, ios::trunc};
+    if (!(file_out << emitter.program(intern(name))).flush())
+      throw runtime_error{"Cannot write " + output};
+  }
+
+  /**
+   * Prints the layout of every class of a compiled file without template
+   * parameters, and the columns of every array of classes that its data
+   * members and function parameters use, with the bytes each saves.
+   */
+  static void report_layouts(const filesystem::path &file, ostream &out) {
+    auto state = states.find(canonical(absolute(file)));
+    if (!state)
+      throw invalid_argument{"Nothing compiled from " + file.u8string()};
+    auto &layouts = state->layouts;
+    uint64_t saved = 0;
+    vector<Reification> used;
+    const auto use = [&used](const shared_ptr<Parameter> &parameter) {
+      if (parameter->reified)
+        used.push_back(parameter->reified);
+    };
+
+    for (auto &module : state->modules)
+      for (auto &[name, classes] : module->classes)
+        for (auto &type : classes) {
+          for (auto &variable : type->data)
+            for_each(begin(variable->parameters), end(variable->parameters),
+                     use);
+          for (auto &function : type->functions)
+            for_each(begin(function->parameters), end(function->parameters),
+                     use);
+          if (!type->parameters.empty())
+            continue;
+          out << "LAYOUT: " << name;
+          try {
+            const auto &layout = layouts.layout(reify(intern(name)));
+            out << " size " << layout.size << " align " << layout.align;
+            if (layout.declared_size != layout.size)
+              out << " (" << layout.declared_size << " as declared)";
+            out << "\n";
+            for (auto &field : layout.fields)
+              out << "  " << spelling(field.name) << " " << describe(field.type)
+                  << " offset " << field.offset << "\n";
+            saved += layout.declared_size - layout.size;
+          } catch (const invalid_argument &e) {
+            out << " not concrete: " << e.what() << "\n";
+          }
+        }
+    for (auto &module : state->modules)
+      for (auto &[name, functions] : module->functions)
+        for (auto &function : functions)
+          for_each(begin(function->parameters), end(function->parameters),
+                   use);
+
+    /**
+     * Arrays nested in a type count too, as in (array (array point 4) 8).
+     */
+    unordered_set<Reification> seen;
+    for (size_t i = 0; i < used.size(); ++i) {
+      const auto type = used[i];
+      if (!seen.insert(type).second)
+        continue;
+      used.insert(end(used), instantiation(type).begin(),
+                  instantiation(type).end());
+      try {
+        const auto &columns = layouts.columns(type);
+        out << "COLUMNS: " << describe(type) << " size " << columns.size
+            << " (" << columns.rows_size << " as rows)\n";
+        for (auto &column : columns.columns)
+          out << "  " << spelling(column.name) << " offset " << column.offset
+              << "\n";
+        saved += columns.rows_size - columns.size;
+      } catch (const invalid_argument &) {
+      }
+    }
+    out << "LAYOUT SAVED: " << saved << " bytes\n";
+  }
+
+  /**
+   * Visits the file's functions, free and member, in declaration order per
+   * table.
+   */
+  template <typename F> void for_each_function(F &&f) const {
+    for (auto &module : modules) {
+      for (auto &[name, functions] : module->functions)
+        for (auto &function : functions)
+          f(*function);
+      for (auto &[name, concepts] : module->concepts)
+        for (auto &concept : concepts)
+          for (auto &function : concept->functions)
+            f(*function);
+      for (auto &[name, classes] : module->classes)
+        for (auto &type : classes)
+          for (auto &function : type->functions)
+            f(*function);
+    }
+  }
+
+  /**
+   * The bodies of the file's functions, with each call bound to the body of
+   * the function bind_calls() chose.
+   */
+  vector<VirtualMachine::Body> bodies() const {
+    unordered_map<const Function *, uint32_t> indices;
+    for_each_function([&indices](const Function &function) {
+      if (!function.body.empty())
+        indices.emplace(&function, indices.size());
+    });
+
+    vector<VirtualMachine::Body> bodies;
+    for_each_function([this, &bodies, &indices](const Function &function) {
+      if (function.body.empty())
+        return;
+      VirtualMachine::Body body{intern(function.name), {}, {}, {}, {}};
+      for (auto &parameter : function.parameters) {
+        body.parameters.push_back(parameter->name);
+        body.constraints.push_back(parameter->accepts.constraint.concept);
+      }
+      const auto bind = [&](auto &bind, ListHandle list) -> void {
+        if (auto call = calls.find(list); call != calls.end()) {
+          auto callee = indices.find(call->second.get());
+          body.calls.emplace(reification(list),
+                             callee == indices.end() ? VirtualMachine::no_body
+                                                     : callee->second);
+        }
+        for (auto part = iterate_list(list); !part.at_tail(); ++part)
+          if (at_nested_list(part))
+            bind(bind, owners[*part]);
+      };
+      for (auto list : function.body) {
+        body.forms.push_back(reification(list));
+        bind(bind, list);
+      }
+      bodies.push_back(move(body));
+    });
+    return bodies;
+  }
+
+  /**
+   * Classes of the file, and the imported ones it uses, for a backend to
+   * map to machine types.
+   */
+  template <typename Backend> void add_classes(Backend &backend) const {
+    for (auto &type : imported_classes)
+      backend.add_class(intern(type->name), type->refinements);
+    for (auto &module : modules)
+      for (auto &[type_name, classes] : module->classes)
+        for (auto &type : classes)
+          backend.add_class(intern(type_name), type->refinements);
+  }
+
+  /**
+   * Loads a module interface. Its entities are decoded on first lookup.
+   */
+  static void import(const filesystem::path &path, ostream &diagnostics) {
+    auto interface = make_shared<const ModuleInterface>(path.u8string());
+    if (!interface->valid())
+      throw invalid_argument{"Invalid module interface " + path.u8string()};
+    auto module = make_shared<Module>();
+    module->name = interface->name();
+    module->interface = move(interface);
+    if (imports.insert(module->name, module))
+      diagnostics << "IMPORT: " << module->name << "\n";
+  }
+
+  /**
+   * The list a token opens or closes, or else the innermost one holding it.
+   */
+  ListHandle find_list(TokenHandle token) const { return owners[token]; }
+
+  ListIterator iterate_list(ListHandle list) const {
     ListIterator iter;
+    iter.state = this;
     iter.list = list;
-    iter.iter = ++lower_bound(cbegin(tokens), cend(tokens), list->head);
+    iter.token = lists[list].head + 1;
     return iter;
   }
 
@@ -340,28 +1214,27 @@ public:
   //   return path;
   // }
 
-  void report_syntax_error(const std::string &message,
-                           const shared_ptr<const Token> &token) {
-    auto top_level =
-        --find_if(reverse_iterator{lower_bound(cbegin(tokens), cend(tokens),
-                                               token)},
-                  reverse_iterator{cbegin(tokens)},
-                  [](const auto &token) { return token->indent == 0; })
-              .base();
-    auto list_iter = iterate_list(find_list(token));
-    while (!list_iter.at_tail())
-      ++list_iter;
-    string what = "Syntax error at line: " + to_string(token->line + 1) +
-                  ", column: " + to_string(token->column + 1) + "\n" + message;
-    string context{cbegin((*top_level)->region),
-                   find(cbegin(token->region), cend(list_iter->region), '\n')};
+  void report_syntax_error(const std::string &message, TokenHandle token) {
+    auto list = find_list(token), top_list = list;
+    while (top_list != no_list && lists[top_list].parent != no_list)
+      top_list = lists[top_list].parent;
+    auto top_level = top_list == no_list ? token : lists[top_list].head;
+    const auto source = tokens.source();
+    const auto region = tokens.region(token);
+    const auto tail =
+        tokens.region(list == no_list ? token : lists[list].tail);
+    string what = "Syntax error at line: " + to_string(tokens.line(token) + 1) +
+                  ", column: " + to_string(tokens.column(token) + 1) + "\n" +
+                  message;
+    string context{cbegin(source) + tokens.pos(top_level),
+                   find(cbegin(region), cend(tail), '\n')};
     what += "┌─" + regex_replace(context, regex{"\\n"}, "\n│ ") + "\n";
-    auto token_offset =
-        distance(find(reverse_iterator{cbegin(token->region)},
-                      reverse_iterator{cbegin((*top_level)->region)}, '\n')
-                     .base(),
-                 cbegin(token->region));
-    string indicator(token->region.length(), '~');
+    auto token_offset = distance(
+        find(reverse_iterator{cbegin(region)},
+             reverse_iterator{cbegin(source) + tokens.pos(top_level)}, '\n')
+            .base(),
+        cbegin(region));
+    string indicator(region.length(), '~');
     indicator.front() = indicator.back() = '^';
     what += "└";
     for (auto i = 0; i <= token_offset; ++i)
@@ -371,46 +1244,243 @@ public:
   }
 
   void parse_file() {
-    for (auto &&list : lists)
-      if (list->head->indent == 0)
-        process_list(list);
+    SymbolScope file_scope{*this};
+    use_imports(file_scope.id);
+    for (ListHandle list = lists.empty() ? no_list : 0; list != no_list;
+         list = lists[list].next)
+      process_list(list);
+    find_imported_types();
+    build_lattice();
+    build_layouts();
+    bind_calls();
   }
 
-  void process_list(const shared_ptr<const List> &list) {
-    // cout << *list->head << " ... ... ... " << *list->tail << "\n";
+  /**
+   * Imported modules are searched after the file's own names, in name
+   * order, and can be used or aliased by name like a module of the file.
+   */
+  void use_imports(uint32_t file_scope) {
+    imports.for_each([this, file_scope](auto &name, auto &module) {
+      const auto scope = symbols.push_scope();
+      symbols.leave_scope();
+      search.open(scope);
+      search.use(file_scope, scope);
+      imported_scopes.emplace(scope, module);
+      imported_modules.push_back(module);
+      module_scopes.emplace(intern(name), scope);
+    });
+  }
+
+  /**
+   * Follows every name in the bases and types of the file's declarations,
+   * and then in the bases of what is found, to the first imported module
+   * declaring it. Names the file declares hide imported ones.
+   */
+  void find_imported_types() {
+    unordered_set<Atom> seen;
+    vector<Atom> names;
+    const auto add = [&seen, &names](Atom name) {
+      if (seen.insert(name).second)
+        names.push_back(name);
+    };
+    const auto add_bases = [&add](const vector<Refinement> &bases) {
+      for (auto &base : bases) {
+        add(base.concept);
+        for_each(begin(base.arguments), end(base.arguments), add);
+      }
+    };
+    const auto add_types = [&add](auto &&parameters) {
+      vector<Reification> types;
+      for (auto &parameter : parameters)
+        types.push_back(parameter->reified);
+      while (!types.empty()) {
+        const auto type = instantiation(types.back());
+        types.pop_back();
+        add(type.entity);
+        types.insert(end(types), type.begin(), type.end());
+      }
+    };
+    const auto add_functions = [&add_types](auto &&functions) {
+      for (auto &function : functions)
+        add_types(function->parameters);
+    };
+
+    for (auto &module : modules) {
+      for (auto &[name, concepts] : module->concepts)
+        seen.insert(intern(name));
+      for (auto &[name, classes] : module->classes)
+        seen.insert(intern(name));
+    }
+    for (auto &module : modules) {
+      for (auto &[name, concepts] : module->concepts)
+        for (auto &concept : concepts) {
+          add_bases(concept->refinements);
+          add_types(concept->parameters);
+          add_functions(concept->functions);
+        }
+      for (auto &[name, classes] : module->classes)
+        for (auto &type : classes) {
+          add_bases(type->refinements);
+          add_types(type->parameters);
+          add_functions(type->functions);
+          for (auto &variable : type->data)
+            add_types(variable->parameters);
+        }
+      for (auto &[name, functions] : module->functions)
+        add_functions(functions);
+    }
+
+    for (size_t i = 0; i < names.size(); ++i)
+      for (auto &module : imported_modules) {
+        const auto name = spelling(names[i]);
+        const auto &concepts = module->find<Concept>(name);
+        const auto &classes = module->find<Class>(name);
+        for (auto &concept : concepts) {
+          imported_concepts.push_back(concept);
+          add_bases(concept->refinements);
+        }
+        for (auto &type : classes) {
+          imported_classes.push_back(type);
+          add_bases(type->refinements);
+        }
+        if (!concepts.empty() || !classes.empty())
+          break;
+      }
+  }
+
+  static vector<Atom> names(const vector<shared_ptr<Parameter>> &parameters) {
+    vector<Atom> atoms;
+    for (auto &parameter : parameters)
+      atoms.push_back(parameter->name);
+    return atoms;
+  }
+
+  void build_lattice() {
+    for (auto &concept : imported_concepts)
+      lattice.add_concept(intern(concept->name), names(concept->parameters),
+                          concept->refinements);
+    for (auto &type : imported_classes)
+      lattice.add_class(intern(type->name), names(type->parameters),
+                        type->refinements);
+    for (auto &module : modules) {
+      for (auto &[name, concepts] : module->concepts)
+        for (auto &concept : concepts)
+          lattice.add_concept(intern(name), names(concept->parameters),
+                              concept->refinements);
+      for (auto &[name, classes] : module->classes)
+        for (auto &type : classes)
+          lattice.add_class(intern(name), names(type->parameters),
+                            type->refinements);
+    }
+    lattice.build();
+  }
+
+  void build_layouts() {
+    for (auto &type : imported_classes)
+      layouts.add_class(intern(type->name), names(type->parameters),
+                        type->refinements, {});
+    for (auto &module : modules)
+      for (auto &[name, classes] : module->classes)
+        for (auto &type : classes) {
+          vector<pair<Atom, Reification>> data;
+          for (auto &variable : type->data)
+            for (auto &field : variable->parameters)
+              data.emplace_back(field->name, field->reified);
+          layouts.add_class(intern(name), names(type->parameters),
+                            type->refinements, move(data));
+        }
+  }
+
+  void process_list(ListHandle list) {
+    // cout << tokens[lists[list].head] << " ... ... ... "
+    //      << tokens[lists[list].tail] << "\n";
 
     current_list.push_back(list);
     auto iter = iterate_list(list);
-    visit(
-        [this /*, &token */](auto &&detail) {
-          using Detail = decay_t<decltype(detail)>;
-          if constexpr (is_same_v<Detail, Token::List>) {
-            // process_list(find_list(token));
-          } else if constexpr (is_same_v<Detail, Token::Identifier>) {
-          } else if constexpr (is_same_v<Detail, Token::Keyword>) {
-            switch (detail.keyword) {
-            default:
-              break;
-            case Keyword::MODULE:
-              declare_module();
-              break;
-            case Keyword::CONCEPT:
-              declare_concept();
-              break;
-            case Keyword::CLASS:
-              declare_class();
-              break;
-            case Keyword::FUNCTION:
-              declare_function();
-              break;
-            }
-          }
-        },
-        iter->detail);
+    switch (tokens.type(*iter)) {
+    default:
+      break;
+    case TokenType::LIST:
+      // process_list(find_list(*iter));
+      break;
+    case TokenType::IDENTIFIER:
+      break;
+    case TokenType::KEYWORD:
+      switch (tokens.keyword(*iter)) {
+      default:
+        break;
+      case Keyword::MODULE:
+        declare_module();
+        break;
+      case Keyword::CONCEPT:
+        declare_concept();
+        break;
+      case Keyword::CLASS:
+        declare_class();
+        break;
+      case Keyword::FUNCTION:
+        declare_function();
+        break;
+      case Keyword::USING:
+        declare_alias();
+        break;
+      }
+      break;
+    }
 
     current_list.pop_back();
   }
 
+  bool at_nested_list(const ListIterator &iter) const {
+    return !iter.at_tail() && tokens.type(*iter) == TokenType::LIST &&
+           owners[*iter] != iter.list;
+  }
+
+  /**
+   * Source text of the element at the iterator, all of it for a list.
+   */
+  string_view element(const ListIterator &iter) const {
+    if (!at_nested_list(iter))
+      return tokens.region(*iter);
+    const auto &list = lists[owners[*iter]];
+    const auto first = tokens.pos(list.head);
+    return tokens.source().substr(first, tokens.pos(list.tail) +
+                                             tokens.region(list.tail).size() -
+                                             first);
+  }
+
+  /**
+   * First token of the nested list at the iterator, which says what it is.
+   */
+  string_view nested_head(const ListIterator &iter) const {
+    if (!at_nested_list(iter))
+      return {};
+    auto inner = iterate_list(owners[*iter]);
+    return inner.at_tail() ? string_view{} : tokens.region(*inner);
+  }
+
+  bool at_keyword_list(const ListIterator &iter, Keyword keyword) const {
+    if (!at_nested_list(iter))
+      return false;
+    auto inner = iterate_list(owners[*iter]);
+    return !inner.at_tail() && tokens.type(*inner) == TokenType::KEYWORD &&
+           tokens.keyword(*inner) == keyword;
+  }
+
+  string_view declared_name(const ListIterator &iter) const {
+    return iter.at_tail() || at_nested_list(iter) ? string_view{}
+                                                  : tokens.region(*iter);
+  }
+
+  /**
+   * Prints the declared name if the iterator is at an identifier.
+   */
+  void print_declaration(const char *kind, const ListIterator &iter) const {
+    if (tokens.type(*iter) == TokenType::IDENTIFIER)
+      diagnostics << kind << ": " << spelling(tokens.identifier(*iter).id)
+                  << "\n";
+  }
+
   // Parse for identifier names first, skip descriptions
   // Parse identifier names as far as parameters
   // - parameters for identifiers for disambiguation
@@ -422,21 +1492,26 @@ public:
     // 2) Identifier
 
     current_module = make_shared<Module>();
-    current_module->locations.emplace(path, current_list.back()->head);
+    current_module->locations.emplace(path, lists[current_list.back()].head);
     modules.push_back(current_module);
 
     shared_ptr<const Id> id;
 
     auto iter = iterate_list(current_list.back());
     ++iter;
-    visit(
-        [](auto &&detail) {
-          using Detail = decay_t<decltype(detail)>;
-          if constexpr (is_same_v<Detail, Token::Identifier>) {
-            cout << "MODULE: " << detail.id << "\n";
-          }
-        },
-        iter->detail);
+    print_declaration("MODULE", iter);
+    current_module->name = declared_name(iter);
+
+    /**
+     * A module's names are visible until the next module starts.
+     */
+    if (symbols.depth() > 1)
+      symbols.leave_scope();
+    const auto file_scope = symbols.current();
+    module_scope = symbols.push_scope();
+    search.open(module_scope, file_scope);
+    if (!current_module->name.empty())
+      module_scopes[intern(current_module->name)] = module_scope;
     if (iter.at_tail() || !(++iter).at_tail())
       ;
   }
@@ -444,7 +1519,7 @@ public:
     RequireLiteral reqlit{*this};
     Declarator<Concept> decl{*this};
     decl->declaration_file = path;
-    decl->declaration = current_list.back()->head;
+    decl->declaration = lists[current_list.back()].head;
     // 1) Keyword
     // 2) Identifier
     // 3) Concept or literal parameters
@@ -455,24 +1530,21 @@ public:
 
     auto concept_listiter = iterate_list(current_list.back());
     ++concept_listiter;
-    visit(
-        [](auto &&detail) {
-          using Detail = decay_t<decltype(detail)>;
-          if constexpr (is_same_v<Detail, Token::Identifier>) {
-            cout << "CONCEPT: " << detail.id << "\n";
-          }
-        },
-        concept_listiter->detail);
+    print_declaration("CONCEPT", concept_listiter);
+    decl->name = declared_name(concept_listiter);
+    symbols.insert(intern(decl->name), decl.get());
 
     ++concept_listiter;
-    if (concept_listiter.at_tail())
-      return;
+    SymbolScope scope{*this};
+    decl->scope = scope.id;
+    declare_members(concept_listiter, *decl);
+    current_module->concepts[string{decl->name}].push_back(decl.get());
   }
   void declare_class() {
     RequireLiteral reqlit{*this};
     Declarator<Class> decl{*this};
     decl->declaration_file = path;
-    decl->declaration = current_list.back()->head;
+    decl->declaration = lists[current_list.back()].head;
     // 1) Keyword
     // 2) Identifier
     // 3) Concept or literal parameters
@@ -482,40 +1554,70 @@ public:
 
     auto list_iter = iterate_list(current_list.back());
     ++list_iter;
-    visit(
-        [](auto &&detail) {
-          using Detail = decay_t<decltype(detail)>;
-          if constexpr (is_same_v<Detail, Token::Identifier>) {
-            cout << "CLASS: " << detail.id << "\n";
-          }
-        },
-        list_iter->detail);
+    print_declaration("CLASS", list_iter);
+    decl->name = declared_name(list_iter);
+    symbols.insert(intern(decl->name), decl.get());
+
+    ++list_iter;
+    SymbolScope scope{*this};
+    decl->scope = scope.id;
+    declare_members(list_iter, *decl);
+    current_module->classes[string{decl->name}].push_back(decl.get());
   }
   void declare_function() {
     RequireLiteral reqlit{*this};
     Declarator<Function> decl{*this};
-    decl->declaration = current_list.back()->head;
+    decl->declaration_file = path;
+    decl->declaration = lists[current_list.back()].head;
     // 1) Keyword
     // 2) Identifier
     // 3) Capture list (: ...)
     // 4) Concept or literal or variable parameters
     // 5) Concept or literal or variable Return type
-    // 6) Function body in description
+    // 6) Function body in description, or inline as (do ...)
     shared_ptr<const Id> id; // Append current concept or class.
 
     auto list_iter = iterate_list(current_list.back());
     ++list_iter;
-    visit(
-        [](auto &&detail) {
-          using Detail = decay_t<decltype(detail)>;
-          if constexpr (is_same_v<Detail, Token::Identifier>) {
-            cout << "FUNCTION: " << detail.id << "\n";
-          }
-        },
-        list_iter->detail);
+    print_declaration("FUNCTION", list_iter);
+    if (!list_iter.at_tail())
+      decl->name = tokens.region(*list_iter);
+    symbols.insert(intern(decl->name), decl.get());
+    SymbolScope scope{*this};
+    decl->scope = scope.id;
+
+    for (++list_iter; !list_iter.at_tail(); ++list_iter)
+      if (at_keyword_list(list_iter, Keyword::DO))
+        decl->body.push_back(owners[*list_iter]);
+      else if (at_keyword_list(list_iter, Keyword::RETURN)) {
+        auto type = iterate_list(owners[*list_iter]);
+        decl->return_type = make_shared<ReturnType>();
+        if (!(++type).at_tail()) {
+          decl->return_type->type = element(type);
+          decl->return_type->reified = reification(type);
+        }
+      } else if (nested_head(list_iter) != ":")
+        decl->parameters.push_back(declare_parameter(list_iter));
+
+    /**
+     * Member functions belong to the concept or class around them.
+     */
+    if (current_scope.size() > 1) {
+      auto &outer = current_scope[current_scope.size() - 2];
+      if (auto concept = outer.pointer<Concept>()) {
+        concept->functions.push_back(decl.get());
+        return;
+      }
+      if (auto type = outer.pointer<Class>()) {
+        type->functions.push_back(decl.get());
+        return;
+      }
+    }
+    current_module->functions[string{decl->name}].push_back(decl.get());
   }
   void declare_scope() {
     current_scope.push_back(Scope{});
+    SymbolScope scope{*this};
     current_scope.pop_back();
   }
   void declare_variable() {
@@ -527,33 +1629,680 @@ public:
     RequireLiteral reqlit{*this};
     // - Check for conflicts
   }
-  void declare_parameter() { RequireLiteral reqlit{*this}; }
+  /**
+   * A parameter is a type, or a (type name) list whose name may be a
+   * ...pack. A bare name is both.
+   */
+  shared_ptr<Parameter> declare_parameter(const ListIterator &iter) {
+    RequireLiteral reqlit{*this};
+    auto parameter = make_shared<Parameter>();
+    parameter->location = *iter;
+    parameter->spelling = element(iter);
+    auto type = iter, name = iter;
+    if (at_nested_list(iter) && nested_head(iter) != "literal") {
+      type = iterate_list(owners[*iter]);
+      for (auto last = type; !(++last).at_tail();)
+        name = last;
+    }
+    if (!at_nested_list(name)) {
+      parameter->name = intern(element(name));
+      parameter->accepts.pack = tokens.type(*name) == TokenType::IDENTIFIER &&
+                                tokens.identifier(*name).pack;
+    }
+    if (!type.at_tail()) {
+      parameter_type(type, parameter->accepts, *type != *name);
+      parameter->reified = reification(type);
+    }
+    return parameter;
+  }
+
+  /**
+   * The element as an instantiation: a token with no arguments, or a list
+   * of its head applied to the rest. A list not headed by a token applies
+   * the empty atom to all of its elements.
+   */
+  Reification reification(const ListIterator &iter) const {
+    return at_nested_list(iter) ? reification(owners[*iter])
+                                : reify(intern(tokens.region(*iter)));
+  }
+
+  Reification reification(ListHandle list) const {
+    auto part = iterate_list(list);
+    Atom entity = 0;
+    if (!part.at_tail() && !at_nested_list(part)) {
+      entity = intern(tokens.region(*part));
+      ++part;
+    }
+    vector<Reification> arguments;
+    for (; !part.at_tail(); ++part)
+      arguments.push_back(reification(part));
+    return reify(entity, arguments);
+  }
+
+  /**
+   * The value of a literal expression, with names bound to the reified
+   * arguments of the instantiation being checked.
+   */
+  optional<ConstantEvaluator::Value>
+  fold(const ListIterator &iter,
+       const ConstantEvaluator::Bindings &bindings = {}) {
+    return constants.evaluate(reification(iter), bindings);
+  }
+
+  /**
+   * A type is a name, a (concept arguments...) list or (literal type). The
+   * type of a (type name) parameter must be declared; a bare name need not
+   * be, as it also names the parameter.
+   */
+  void parameter_type(ListIterator iter, ParameterType &type,
+                      bool declared) {
+    if (nested_head(iter) == "literal") {
+      type.literal = true;
+      iter = iterate_list(owners[*iter]);
+      if ((++iter).at_tail())
+        return;
+      return parameter_type(iter, type, declared);
+    }
+    type.constraint = declare_refinement(iter);
+    if (declared)
+      require_type(iter);
+    require_lengths(iter);
+  }
+
+  /**
+   * Reports the concept or class named by a type or base at iter unless it
+   * is in scope, imported or a template parameter of an enclosing
+   * declaration.
+   */
+  void require_type(const ListIterator &iter) {
+    auto head = at_nested_list(iter) ? iterate_list(owners[*iter]) : iter;
+    if (head.at_tail() || at_nested_list(head) ||
+        tokens.type(*head) != TokenType::IDENTIFIER)
+      return;
+    const auto name = intern(tokens.region(*head));
+    for (auto &declared : resolve(name))
+      if (!holds_alternative<shared_ptr<const Function>>(declared))
+        return;
+    const auto parameters = template_parameters();
+    if (find(begin(parameters), end(parameters), name) != end(parameters))
+      return;
+    report_syntax_error("Not a concept or class in scope:\n", *head);
+  }
+
+  /**
+   * Names of the parameters of the concepts, classes and functions being
+   * declared, which stand for arguments known only on instantiation.
+   */
+  vector<Atom> template_parameters() const {
+    vector<Atom> names;
+    const auto add = [&names](auto &&entity) {
+      if (entity)
+        for (auto &parameter : entity->parameters)
+          names.push_back(parameter->name);
+    };
+    for (auto &scope : current_scope) {
+      add(scope.pointer<Concept>());
+      add(scope.pointer<Class>());
+      add(scope.pointer<Function>());
+    }
+    return names;
+  }
+
+  /**
+   * Reports every array length in a type that is not a natural number.
+   * A length naming a template parameter is left to instantiation.
+   */
+  void require_lengths(const ListIterator &iter) {
+    if (!at_nested_list(iter))
+      return;
+    auto part = iterate_list(owners[*iter]);
+    const auto array = !part.at_tail() && !at_nested_list(part) &&
+                       tokens.region(*part) == "array";
+    for (size_t i = 0; !part.at_tail(); ++part, ++i) {
+      if (!array || i != 2) {
+        require_lengths(part);
+        continue;
+      }
+      const auto value = require_constant(part, template_parameters());
+      const auto number = value ? get_if<Rational>(&*value) : nullptr;
+      if (value && (!number || !number->is_integer() ||
+                    (number->negative && !number->numerator.is_zero())))
+        report_syntax_error("Array length is not a natural number:\n",
+                            *part);
+    }
+  }
+
+  /**
+   * The value of a literal expression, reported if it does not fold. An
+   * expression naming one of deferred has no value until instantiation.
+   */
+  optional<ConstantEvaluator::Value>
+  require_constant(const ListIterator &iter, const vector<Atom> &deferred) {
+    const auto mentions = [&deferred](auto &mentions, Reification form) {
+      const auto in = instantiation(form);
+      return find(begin(deferred), end(deferred), in.entity) !=
+                 end(deferred) ||
+             any_of(in.begin(), in.end(),
+                    [&mentions](auto f) { return mentions(mentions, f); });
+    };
+    if (mentions(mentions, reification(iter)))
+      return {};
+    auto value = fold(iter);
+    if (!value)
+      report_syntax_error("Not a constant expression:\n", *iter);
+    return value;
+  }
+
+  /**
+   * Template parameters (<> ...), bases (: ...) and member functions of a
+   * concept or class. Bases are recorded as written, each a name or a
+   * (name arguments...) list, and left for resolution. A class's data
+   * members are declared in (readable ...), (writable ...) or
+   * (mutable ...) lists of (type name) fields.
+   */
+  template <typename Entity>
+  void declare_members(ListIterator iter, Entity &entity) {
+    for (; !iter.at_tail(); ++iter)
+      if (nested_head(iter) == "<>") {
+        auto parameter = iterate_list(owners[*iter]);
+        for (++parameter; !parameter.at_tail(); ++parameter)
+          entity.parameters.push_back(declare_parameter(parameter));
+      } else if (nested_head(iter) == ":") {
+        auto base = iterate_list(owners[*iter]);
+        for (++base; !base.at_tail(); ++base) {
+          require_type(base);
+          entity.refinements.push_back(declare_refinement(base));
+        }
+      } else if (at_keyword_list(iter, Keyword::FUNCTION)) {
+        current_list.push_back(owners[*iter]);
+        declare_function();
+        current_list.pop_back();
+      } else if (at_keyword_list(iter, Keyword::USING)) {
+        current_list.push_back(owners[*iter]);
+        declare_alias();
+        current_list.pop_back();
+      } else if constexpr (is_same_v<Entity, Class>) {
+        if (at_keyword_list(iter, Keyword::READABLE) ||
+            at_keyword_list(iter, Keyword::WRITABLE) ||
+            at_keyword_list(iter, Keyword::MUTABLE)) {
+          auto variable = make_shared<Variable>();
+          variable->location = *iter;
+          auto field = iterate_list(owners[*iter]);
+          for (++field; !field.at_tail(); ++field)
+            variable->parameters.push_back(declare_parameter(field));
+          entity.data.push_back(variable);
+        }
+      }
+  }
+  Refinement declare_refinement(const ListIterator &iter) const {
+    if (!at_nested_list(iter))
+      return {intern(tokens.region(*iter)), {}};
+    auto part = iterate_list(owners[*iter]);
+    Refinement refinement{intern(element(part)), {}};
+    while (!(++part).at_tail())
+      refinement.arguments.push_back(intern(element(part)));
+    return refinement;
+  }
+
+  /**
+   * (using space)          Searches a module, concept or class after the
+   *                        current scope's own names.
+   * (using (space name))   Makes name stand for name in space: a module
+   *                        entity, or an inherited or free function used as
+   *                        a member.
+   * (using alias target)   Makes alias stand for target as seen from here,
+   *                        or from space if target is (space name).
+   * (using name delete)    Reverses the above for name.
+   *
+   * space may also be this-module, this-concept, this-class or this-scope.
+   */
   void declare_alias() {
-    // - Using free function as member function
-    // - Using inherited function as member function
-    // - Using module namespace
-    // - Using module entities
-    // - Using source declaration
-    // - Reverse the effects of using
+    const auto scope = symbols.current();
+    auto iter = iterate_list(current_list.back());
+    const auto head = *iter;
+    vector<ListIterator> elements;
+    for (++iter; !iter.at_tail(); ++iter)
+      elements.push_back(iter);
+
+    if (elements.size() == 1 && !at_nested_list(elements[0])) {
+      search.use(scope, namespace_scope(elements[0]));
+      return;
+    }
+    if (elements.size() == 1) {
+      auto [space, name] = qualified_target(elements[0]);
+      search.alias(scope, name, {space, name});
+      return;
+    }
+    if (elements.size() != 2 || at_nested_list(elements[0]))
+      report_syntax_error("Expected (using space), (using (space name)) or "
+                          "(using alias target):\n",
+                          head);
+
+    const auto name = intern(tokens.region(*elements[0]));
+    if (tokens.type(*elements[1]) == TokenType::KEYWORD &&
+        tokens.keyword(*elements[1]) == Keyword::DELETE) {
+      search.unalias(scope, name);
+      if (auto space = module_scopes.find(name); space != module_scopes.end())
+        search.unuse(scope, space->second);
+      else if (auto space = entity_scope(resolve(name)))
+        search.unuse(scope, space);
+      return;
+    }
+    if (at_nested_list(elements[1])) {
+      auto [space, target] = qualified_target(elements[1]);
+      search.alias(scope, name, {space, target});
+    } else
+      search.alias(scope, name, {scope, intern(tokens.region(*elements[1]))});
+  }
+
+  /**
+   * The names in scope of a module of this file, a concept or a class, named
+   * by the element at iter.
+   */
+  uint32_t namespace_scope(const ListIterator &iter) {
+    if (tokens.type(*iter) == TokenType::KEYWORD)
+      switch (tokens.keyword(*iter)) {
+      default:
+        break;
+      case Keyword::THIS_MODULE:
+        return module_scope;
+      case Keyword::THIS_SCOPE:
+        return symbols.current();
+      case Keyword::THIS_CONCEPT:
+        for (auto s = rbegin(current_scope); s != rend(current_scope); ++s)
+          if (auto concept = s->pointer<Concept>())
+            return concept->scope;
+        break;
+      case Keyword::THIS_CLASS:
+        for (auto s = rbegin(current_scope); s != rend(current_scope); ++s)
+          if (auto type = s->pointer<Class>())
+            return type->scope;
+        break;
+      }
+
+    const auto name = intern(tokens.region(*iter));
+    if (auto space = module_scopes.find(name); space != module_scopes.end())
+      return space->second;
+    if (auto space = entity_scope(resolve(name)))
+      return space;
+    report_syntax_error("Not a module, concept or class in scope:\n", *iter);
+    return 0;
+  }
+
+  /**
+   * (space name) as the scope to look name up from, and name.
+   */
+  pair<uint32_t, Atom> qualified_target(const ListIterator &iter) {
+    auto inner = iterate_list(owners[*iter]);
+    auto space = inner;
+    if (inner.at_tail() || (++inner).at_tail() || at_nested_list(inner) ||
+        !(++ListIterator{inner}).at_tail())
+      report_syntax_error("Expected (space name):\n", *iter);
+    return {namespace_scope(space), intern(tokens.region(*inner))};
+  }
+
+  uint32_t entity_scope(const vector<Declared> &overloads) {
+    if (overloads.empty())
+      return 0;
+    if (auto concept = get_if<shared_ptr<const Concept>>(&overloads.front()))
+      return (*concept)->scope;
+    if (auto type = get_if<shared_ptr<const Class>>(&overloads.front()))
+      return (*type)->scope;
+    return 0;
+  }
+
+  /**
+   * Looks name up from the current scope along its memoized search order.
+   * In each scope, declarations come before an alias of the same name.
+   */
+  vector<Declared> resolve(Atom name) {
+    return resolve(symbols.current(), name, 0);
+  }
+
+  vector<Declared> resolve(uint32_t from, Atom name, int aliases) {
+    if (from == 0)
+      return {};
+    for (auto scope : search.order(from)) {
+      if (auto module = imported_scopes.find(scope);
+          module != imported_scopes.end()) {
+        if (auto overloads = find_imported(*module->second, name);
+            !overloads.empty())
+          return overloads;
+      } else if (auto overloads = symbols.find_in(scope, name);
+                 !overloads.empty())
+        return {begin(overloads), end(overloads)};
+      if (auto alias = search.find_alias(scope, name);
+          alias && aliases < max_aliases)
+        return resolve(alias->scope, alias->name, aliases + 1);
+    }
+    return {};
+  }
+  static constexpr int max_aliases = 32; // Gives up on alias cycles
+
+  /**
+   * The concepts, classes and functions called name in an imported module,
+   * decoded from its interface on first lookup.
+   */
+  static vector<Declared> find_imported(Module &module, Atom name) {
+    vector<Declared> overloads;
+    const auto text = spelling(name);
+    for (auto &concept : module.find<Concept>(text))
+      overloads.push_back(concept);
+    for (auto &type : module.find<Class>(text))
+      overloads.push_back(type);
+    for (auto &function : module.find<Function>(text))
+      overloads.push_back(function);
+    return overloads;
+  }
+
+  /**
+   * The functions that a call of name from a scope chooses among, or null
+   * if name resolves to none.
+   */
+  const OverloadSet *overload_set(uint32_t from, Atom name) {
+    OverloadSet added;
+    vector<const Function *> key;
+    for (auto &declaration : resolve(from, name, 0))
+      if (auto function = get_if<shared_ptr<const Function>>(&declaration)) {
+        added.functions.push_back(*function);
+        key.push_back(function->get());
+      }
+    auto set = overload_sets.find(key);
+    if (set == overload_sets.end()) {
+      vector<OverloadResolver::Signature> signatures;
+      for (auto &function : added.functions) {
+        signatures.emplace_back();
+        for (auto &parameter : function->parameters)
+          signatures.back().push_back(parameter->accepts);
+      }
+      added.id = overloads.add_set(move(signatures));
+      set = overload_sets.emplace(move(key), move(added)).first;
+    }
+    return set->second.functions.empty() ? nullptr : &set->second;
+  }
+
+  /**
+   * Binds every call in the bodies of the file's functions to one of its
+   * overloads. Concepts are only known once the file is parsed.
+   */
+  void bind_calls() {
+    for_each_function([this](const Function &function) {
+      for (auto list : function.body)
+        bind_calls(function, list);
+    });
+  }
+
+  /**
+   * Binds the calls in a list, innermost first, and returns the type of its
+   * value if known. A list is a call if its head names a function in scope;
+   * others, such as the forms of the machine, are not.
+   *
+   * A call is resolved through the lattice when the type of every argument
+   * is known. Otherwise the number of arguments must pick out one overload,
+   * as the rest is only known once a template is instantiated.
+   */
+  optional<Argument> bind_calls(const Function &function, ListHandle list) {
+    auto part = iterate_list(list);
+    if (part.at_tail())
+      return {};
+    const auto head = part;
+    vector<Argument> arguments;
+    size_t count = 0;
+    for (++part; !part.at_tail(); ++part, ++count)
+      if (auto argument = at_nested_list(part)
+                              ? bind_calls(function, owners[*part])
+                              : value_type(function, *part))
+        arguments.push_back(*argument);
+    if (at_nested_list(head)) {
+      bind_calls(function, owners[*head]);
+      return {};
+    }
+    if (tokens.type(*head) != TokenType::IDENTIFIER)
+      return {};
+    const auto set = overload_set(function.scope, intern(element(head)));
+    if (!set)
+      return {};
+
+    shared_ptr<const Function> callee;
+    if (arguments.size() == count) {
+      const auto winner = overloads.resolve(set->id, arguments);
+      if (winner == OverloadResolver::ambiguous)
+        report_syntax_error("More than one function takes these arguments:\n",
+                            *head);
+      if (winner == OverloadResolver::no_match)
+        report_syntax_error("No function takes these arguments:\n", *head);
+      callee = set->functions[winner];
+    } else
+      for (auto &candidate : set->functions) {
+        const auto &parameters = candidate->parameters;
+        const auto pack = any_of(begin(parameters), end(parameters),
+                                 [](auto &p) { return p->accepts.pack; });
+        if (pack ? count + 1 < parameters.size()
+                 : count != parameters.size())
+          continue;
+        if (callee)
+          report_syntax_error("More than one function takes this many "
+                              "arguments:\n",
+                              *head);
+        callee = candidate;
+      }
+    if (!callee)
+      report_syntax_error("No function takes this many arguments:\n", *head);
+    calls.emplace(list, callee);
+
+    /**
+     * An argument to a literal parameter must fold, unless it uses a
+     * literal parameter of the caller.
+     */
+    vector<Atom> deferred;
+    for (auto &parameter : function.parameters)
+      if (parameter->accepts.literal)
+        deferred.push_back(parameter->name);
+    const auto &parameters = callee->parameters;
+    part = head;
+    for (size_t i = 0; !(++part).at_tail(); ++i)
+      if (parameters[min(i, parameters.size() - 1)]->accepts.literal)
+        require_constant(part, deferred);
+
+    if (!callee->return_type)
+      return {};
+    const auto returned = instantiation(callee->return_type->reified);
+    if (returned.arity || !lattice.is_class(returned.entity))
+      return {};
+    return Argument{returned.entity, false};
+  }
 
-    // Build hierarchy of search order
+  /**
+   * The type of a token's value if known: a literal, or a parameter naming
+   * a class.
+   */
+  optional<Argument> value_type(const Function &function,
+                                TokenHandle token) {
+    using Literal = ConceptLattice::Literal;
+    const auto literal = [this](Literal kind) {
+      return Argument{lattice.literal_type(kind), true};
+    };
+    switch (tokens.type(token)) {
+    default:
+      return {};
+    case TokenType::NUMBER: {
+      const auto value = Rational::parse(tokens.region(token));
+      return literal(value && !value->is_integer() ? Literal::RATIONAL
+                                                   : Literal::INTEGER);
+    }
+    case TokenType::STRING:
+      return literal(Literal::STRING);
+    case TokenType::KEYWORD:
+      if (tokens.keyword(token) != Keyword::TRUE &&
+          tokens.keyword(token) != Keyword::FALSE)
+        return {};
+      return literal(Literal::BOOLEAN);
+    case TokenType::IDENTIFIER:
+      for (auto &parameter : function.parameters)
+        if (parameter->name == intern(tokens.region(token)) &&
+            lattice.is_class(parameter->accepts.constraint.concept))
+          return Argument{parameter->accepts.constraint.concept,
+                          parameter->accepts.literal};
+      return {};
+    }
   }
   void declare_label() {}
 };
 
-map<filesystem::path, shared_ptr<const string>> ParseState::sources;
-map<filesystem::path, shared_ptr<ParseState>> ParseState::states;
-vector<shared_ptr<Module>> ParseState::modules;
+ConcurrentMap<filesystem::path, shared_ptr<const Source>> ParseState::sources;
+ConcurrentMap<filesystem::path, shared_ptr<ParseState>> ParseState::states;
+TokenCache ParseState::cache;
+ConcurrentMap<string, shared_ptr<Module>> ParseState::imports;
+string ParseState::interface_directory;
+
+/**
+ * Files named on the command line, with directories expanded to the .decl
+ * files under them in path order. Each file appears once.
+ */
+vector<filesystem::path> collect_files(char **first, char **last) {
+  vector<filesystem::path> files;
+  set<filesystem::path> seen;
+  const auto add = [&files, &seen](const filesystem::path &file) {
+    error_code error;
+    auto full_path = canonical(absolute(file), error);
+    if (seen.insert(error ? file : full_path).second)
+      files.push_back(file);
+  };
 
-// Parameter matching - packs and concepts
-// Concept matching
+  for (; first != last; ++first)
+    if (filesystem::path arg{*first}; is_directory(arg)) {
+      vector<filesystem::path> found;
+      for (auto &entry : filesystem::recursive_directory_iterator{arg})
+        if (is_regular_file(entry.path()) &&
+            entry.path().extension() == ".decl")
+          found.push_back(entry.path());
+      sort(begin(found), end(found));
+      for_each(begin(found), end(found), add);
+    } else
+      add(arg);
+  return files;
+}
 
-int main(int, char **v) {
-  try {
-    ParseState::compile(v[1]);
-  } catch (invalid_argument e) {
-    cout << e.what() << "\n";
+/**
+ * Everything main does, which throws whatever is not a file's own error.
+ */
+int compile_and_run(int argc, char **v) {
+  unsigned threads = 0;
+  string cache_directory = ".tonal-cache";
+  string prelude_output, run_function, emit_output;
+  bool report_layouts = false;
+  auto first = v + 1;
+  for (; first != v + argc && **first == '-'; ++first)
+    if (string_view option{*first}; option.substr(0, 2) == "-j") {
+      const string count{option.substr(2)};
+      if (count.empty() ||
+          count.find_first_not_of("0123456789") != string::npos)
+        throw invalid_argument{"-j takes a number of threads"};
+      threads = stoul(count);
+    } else if (option.substr(0, 2) == "-c")
+      cache_directory = option.substr(2);
+    else if (option.substr(0, 2) == "-i")
+      ParseState::interface_directory = option.substr(2);
+    else if (option.substr(0, 2) == "-p")
+      prelude_output = option.substr(2);
+    else if (option.substr(0, 2) == "-r")
+      run_function = option.substr(2);
+    else if (option.substr(0, 2) == "-e")
+      emit_output = option.substr(2);
+    else if (option == "-l")
+      report_layouts = true;
+    else
+      throw invalid_argument{"Unknown option " + string{option}};
+  ParseState::cache = TokenCache{cache_directory};
+  const auto files = collect_files(first, v + argc);
+
+  /**
+   * -p, -r, -e and -l act on the first file compiled rather than imported.
+   */
+  const auto is_compiled = [](const filesystem::path &file) {
+    return file.extension() != ".tmi";
+  };
+  const auto compiled = find_if(cbegin(files), cend(files), is_compiled);
+  if (!prelude_output.empty() &&
+      count_if(cbegin(files), cend(files), is_compiled) != 1)
+    throw invalid_argument{"-p takes exactly one file to compile"};
+  if (!run_function.empty() && compiled == cend(files))
+    throw invalid_argument{"-r takes a file to compile"};
+  if (!emit_output.empty() && run_function.empty())
+    throw invalid_argument{"-e takes a function from -r"};
+  if (report_layouts && compiled == cend(files))
+    throw invalid_argument{"-l takes a file to compile"};
+  ParseState::load_prelude();
+
+  /**
+   * Interfaces are all imported first, so that any file may use them.
+   */
+  vector<ostringstream> diagnostics(files.size());
+  vector<exception_ptr> errors(files.size());
+  const auto process = [&files, &diagnostics, &errors](size_t i) {
+    try {
+      if (files[i].extension() == ".tmi")
+        ParseState::import(files[i], diagnostics[i]);
+      else
+        ParseState::compile(files[i], diagnostics[i]);
+    } catch (const invalid_argument &e) {
+      diagnostics[i] << e.what() << "\n";
+    } catch (...) {
+      errors[i] = current_exception();
+    }
+  };
+  for (size_t i = 0; i < files.size(); ++i)
+    if (files[i].extension() == ".tmi")
+      process(i);
+  {
+    WorkStealingPool pool{threads};
+    for (size_t i = 0; i < files.size(); ++i)
+      if (files[i].extension() != ".tmi")
+        pool.submit([&process, i] { process(i); });
+  }
+
+  for (size_t i = 0; i < files.size(); ++i) {
+    cout << diagnostics[i].str();
+    if (errors[i])
+      rethrow_exception(errors[i]);
   }
+  if (!prelude_output.empty())
+    ParseState::write_prelude(*compiled, prelude_output);
+  if (report_layouts)
+    ParseState::report_layouts(*compiled, cout);
+  if (!emit_output.empty())
+    ParseState::emit(*compiled, run_function, emit_output);
+  else if (!run_function.empty())
+    ParseState::run(*compiled, run_function, cout);
 
   return 0;
 }
+
+/**
+ * tonal [-j<threads>] [-c<cache directory>] [-i<interface directory>]
+ *       [-p<prelude output>] [-r<function> [-e<C++ output>]] [-l]
+ *       <file or directory>...
+ *
+ * Files are compiled concurrently. Each file's output and error are printed
+ * in command line order, whatever order the files finish in. Lexed files are
+ * cached in .tonal-cache unless another directory is given; a bare -c turns
+ * the cache off. With -i, named modules are written to the interface
+ * directory as .tmi files. Any .tmi file given is imported before anything
+ * is compiled, and its names are visible to every file after the file's own.
+ * With -p, the one file compiled is written out as C++ tables for
+ * prelude.cpp. With -r, the function is run from the first file compiled,
+ * not imported, once all are; with -e as well, it is written out as a C++
+ * program instead. With -l, the data layouts of that file are printed.
+ * The prelude built into the executable is always loaded first.
+ * An error that is not a file's own, as in an unknown option or in running,
+ * is printed to standard error and the exit status is 1.
+ */
+int main(int argc, char **v) {
+  try {
+    return compile_and_run(argc, v);
+  } catch (const exception &e) {
+    cout.flush();
+    cerr << e.what() << "\n";
+    return 1;
+  }
+}
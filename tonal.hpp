@@ -1,4 +1,5 @@
 #pragma once
 
+#include "entity.hpp"
 #include "identifier.hpp"
 #include "symboltable.hpp"
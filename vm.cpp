@@ -0,0 +1,710 @@
+#include "vm.hpp"
+#include "number.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+using namespace tonal;
+
+namespace {
+uint64_t signature(Atom name, size_t arity) {
+  return static_cast<uint64_t>(name) << 32 | arity;
+}
+
+/**
+ * value converted to the C++ type of a Scalar, and back. Out of range, a
+ * float becomes the smallest integer, as x86 converts it.
+ */
+int64_t narrow(int64_t value, Scalar::Kind kind, uint32_t bits) {
+  using Kind = Scalar::Kind;
+  if (kind == Kind::BOOLEAN)
+    return value != 0;
+  if (kind == Kind::FLOAT) {
+    const auto rounded = bits == 32 ? static_cast<float>(value)
+                                    : static_cast<double>(value);
+    return rounded < 0x1p63 ? static_cast<int64_t>(rounded)
+                            : numeric_limits<int64_t>::min();
+  }
+  const auto shift = 64 - bits;
+  const auto low = static_cast<uint64_t>(value) << shift;
+  if (kind == Kind::SIGNED || (kind == Kind::CHARACTER && bits == 8))
+    return static_cast<int64_t>(low) >> shift;
+  return static_cast<int64_t>(low >> shift);
+}
+
+bool contains(Reification form, Atom atom) {
+  const auto in = instantiation(form);
+  return in.entity == atom || any_of(in.begin(), in.end(), [atom](auto f) {
+           return contains(f, atom);
+         });
+}
+} // namespace
+
+/**
+ * Lowers one body. Named locals get the registers after the parameters,
+ * found before lowering so that temporaries, allocated in stack order above
+ * them, never overlap one.
+ */
+class VirtualMachine::Lowering {
+public:
+  Lowering(const VirtualMachine &vm, const Body &body, Code &code)
+      : vm(vm), body(body), code(code) {
+    for (auto parameter : body.parameters)
+      locals.emplace(parameter, next++);
+    for (auto form : body.forms)
+      declare_locals(form);
+    first_temporary = next;
+
+    for (size_t i = 0; i < body.constraints.size(); ++i)
+      if (auto type = vm.machine_types.find(body.constraints[i]);
+          type != vm.machine_types.end())
+        emit(Op::NARROW, locals.at(body.parameters[i]),
+             static_cast<uint32_t>(type->second.kind), type->second.bits);
+
+    const auto result = temporary();
+    if (body.forms.empty())
+      emit(Op::LOAD, result, constant(0));
+    for (auto form : body.forms)
+      lower(form, result);
+    emit(Op::RETURN, result);
+  }
+
+private:
+  void declare_locals(Reification form) {
+    const auto in = instantiation(form);
+    if (((in.entity == assign && in.arity == 2) ||
+         (in.entity == catch_ && in.arity >= 1)) &&
+        !instantiation(in.arguments[0]).arity) {
+      const auto name = instantiation(in.arguments[0]).entity;
+      if (!locals.count(name))
+        locals.emplace(name, next++);
+    }
+    for (auto argument : in)
+      declare_locals(argument);
+  }
+
+  uint32_t temporary() {
+    code.registers = max(code.registers, next + 1);
+    return next++;
+  }
+
+  uint32_t emit(Op op, uint32_t a = 0, uint32_t b = 0, uint32_t c = 0) {
+    code.instructions.push_back({nullptr, op, a, b, c});
+    return code.instructions.size() - 1;
+  }
+
+  uint32_t here() const { return code.instructions.size(); }
+
+  uint32_t constant(int64_t value) {
+    auto [entry, added] = constants.emplace(value, code.constants.size());
+    if (added)
+      code.constants.push_back(value);
+    return entry->second;
+  }
+
+  [[noreturn]] void fail(const string &what, Reification form) const {
+    throw invalid_argument{what + " in function " +
+                           string{spelling(body.name)} + ": " +
+                           describe(form)};
+  }
+
+  /**
+   * The register holding the value of form: a local's own, or a temporary
+   * that the caller releases by resetting next.
+   */
+  uint32_t operand(Reification form) {
+    const auto in = instantiation(form);
+    if (!in.arity)
+      if (auto local = locals.find(in.entity); local != locals.end())
+        return local->second;
+    const auto target = temporary();
+    lower(form, target);
+    return target;
+  }
+
+  void lower(Reification form, uint32_t target) {
+    const auto in = instantiation(form);
+    const auto mark = next;
+    if (!in.arity)
+      leaf(form, target);
+    else if (target < first_temporary && !writes_target_last(in))
+      /**
+       * A form that may read a local after writing its target goes
+       * through a temporary when the target is a local.
+       */
+      emit(Op::MOVE, target, operand(form));
+    else
+      compound(form, target);
+    next = mark;
+  }
+
+  bool writes_target_last(const Instantiation &in) const {
+    const auto op = in.entity;
+    return in.arity == 2 && (op == add || op == subtract || op == multiply ||
+                             op == divide || op == modulo || op == less ||
+                             op == greater || op == less_equal ||
+                             op == greater_equal || op == equal ||
+                             op == not_equal || op == assign);
+  }
+
+  void leaf(Reification form, uint32_t target) {
+    const auto atom = instantiation(form).entity;
+    if (auto local = locals.find(atom); local != locals.end()) {
+      if (local->second != target)
+        emit(Op::MOVE, target, local->second);
+      return;
+    }
+    if (atom == yes || atom == no) {
+      emit(Op::LOAD, target, constant(atom == yes));
+      return;
+    }
+
+    try {
+      if (auto value = number(atom)) {
+        emit(Op::LOAD, target, constant(*value));
+        return;
+      }
+    } catch (const out_of_range &) {
+      fail("Not a 64-bit integer", form);
+    }
+
+    /**
+     * A call without arguments is reified as its name alone.
+     */
+    if (body.calls.count(form))
+      return compound(form, target);
+    fail("Unknown name", form);
+  }
+
+  void compound(Reification form, uint32_t target) {
+    const auto in = instantiation(form);
+    const auto op = in.entity;
+    const auto arguments = in.arguments;
+    const auto arity = in.arity;
+
+    if (op == assign && arity == 2) {
+      if (instantiation(arguments[0]).arity)
+        fail("Cannot assign to a form", form);
+      const auto local = locals.at(instantiation(arguments[0]).entity);
+      lower(arguments[1], local);
+      if (local != target)
+        emit(Op::MOVE, target, local);
+    } else if (op == add || op == multiply || (op == subtract && arity > 1) ||
+               op == divide || op == modulo) {
+      const auto code = op == add        ? Op::ADD
+                        : op == multiply ? Op::MUL
+                        : op == subtract ? Op::SUB
+                        : op == divide   ? Op::DIV
+                                         : Op::MOD;
+      auto left = operand(arguments[0]);
+      for (uint32_t i = 1; i < arity; ++i) {
+        const auto right = operand(arguments[i]);
+        emit(code, target, left, right);
+        left = target;
+      }
+      if (left != target)
+        emit(Op::MOVE, target, left);
+    } else if (op == subtract) {
+      const auto value = operand(arguments[0]), zero = temporary();
+      emit(Op::LOAD, zero, constant(0));
+      emit(Op::SUB, target, zero, value);
+    } else if ((op == less || op == greater || op == less_equal ||
+                op == greater_equal || op == equal || op == not_equal) &&
+               arity == 2) {
+      /**
+       * Operands are lowered left to right; > and <= swap them for <.
+       */
+      const auto left = operand(arguments[0]), right = operand(arguments[1]);
+      const auto swapped = op == greater || op == less_equal;
+      emit(op == equal || op == not_equal ? Op::EQUAL : Op::LESS, target,
+           swapped ? right : left, swapped ? left : right);
+      if (op == greater_equal || op == less_equal || op == not_equal)
+        emit(Op::NOT, target, target);
+    } else if (op == negate && arity == 1)
+      emit(Op::NOT, target, operand(arguments[0]));
+    else if ((op == conjoin || op == disjoin) && arity >= 1) {
+      vector<uint32_t> exits;
+      for (uint32_t i = 0; i < arity; ++i) {
+        lower(arguments[i], target);
+        if (i + 1 < arity)
+          exits.push_back(emit(op == conjoin ? Op::IFNOT : Op::IF, target));
+      }
+      emit(Op::NOT, target, target);
+      emit(Op::NOT, target, target);
+      for (auto exit : exits)
+        code.instructions[exit].b = here() - 2;
+    } else if (op == if_ && (arity == 2 || arity == 3)) {
+      const auto otherwise = emit(Op::IFNOT, operand(arguments[0]));
+      lower(arguments[1], target);
+      const auto end = emit(Op::JUMP);
+      code.instructions[otherwise].b = here();
+      if (arity == 3)
+        lower(arguments[2], target);
+      else
+        emit(Op::LOAD, target, constant(0));
+      code.instructions[end].a = here();
+    } else if (op == switch_ && arity >= 1) {
+      const auto value = temporary();
+      lower(arguments[0], value);
+      vector<uint32_t> ends;
+      bool otherwise = false;
+      for (uint32_t i = 1; i < arity; ++i) {
+        const auto clause = instantiation(arguments[i]);
+        const auto mark = next;
+        if (clause.entity == case_ && clause.arity >= 1 && !otherwise) {
+          const auto test = temporary();
+          emit(Op::EQUAL, test, value, operand(clause.arguments[0]));
+          const auto skip = emit(Op::IFNOT, test);
+          sequence(clause, 1, target);
+          ends.push_back(emit(Op::JUMP));
+          code.instructions[skip].b = here();
+        } else if (clause.entity == default_ && !otherwise) {
+          sequence(clause, 0, target);
+          otherwise = true;
+        } else
+          fail("Not a case before any default", arguments[i]);
+        next = mark;
+      }
+      if (!otherwise)
+        emit(Op::LOAD, target, constant(0));
+      for (auto end : ends)
+        code.instructions[end].a = here();
+    } else if (op == while_ && arity >= 1) {
+      const auto top = here();
+      const auto exit = emit(Op::IFNOT, operand(arguments[0]));
+      const auto scratch = temporary();
+      for (uint32_t i = 1; i < arity; ++i)
+        lower(arguments[i], scratch);
+      emit(Op::JUMP, top);
+      code.instructions[exit].b = here();
+      emit(Op::LOAD, target, constant(0));
+    } else if (op == for_ && arity >= 3) {
+      const auto scratch = temporary();
+      lower(arguments[0], scratch);
+      const auto top = here();
+      const auto exit = emit(Op::IFNOT, operand(arguments[1]));
+      for (uint32_t i = 3; i < arity; ++i)
+        lower(arguments[i], scratch);
+      lower(arguments[2], scratch);
+      emit(Op::JUMP, top);
+      code.instructions[exit].b = here();
+      emit(Op::LOAD, target, constant(0));
+    } else if (op == throw_ && arity == 1)
+      emit(Op::THROW, operand(arguments[0]));
+    else if (op == try_ && arity >= 1) {
+      const auto handler = instantiation(arguments[arity - 1]);
+      if (handler.entity != catch_ || !handler.arity ||
+          instantiation(handler.arguments[0]).arity)
+        fail("No (catch name forms...) ending", form);
+      const auto enter =
+          emit(Op::TRY, locals.at(instantiation(handler.arguments[0]).entity));
+      ++inside_try;
+      sequence(in, 0, target, arity - 1);
+      --inside_try;
+      emit(Op::UNTRY);
+      const auto end = emit(Op::JUMP);
+      code.instructions[enter].b = here();
+      sequence(handler, 1, target);
+      code.instructions[end].a = here();
+    } else if (op == do_) {
+      if (!arity)
+        emit(Op::LOAD, target, constant(0));
+      for (uint32_t i = 0; i < arity; ++i)
+        lower(arguments[i], target);
+    } else if (op == return_ && arity <= 1) {
+      if (arity)
+        emit(Op::RETURN, operand(arguments[0]));
+      else {
+        emit(Op::LOAD, target, constant(0));
+        emit(Op::RETURN, target);
+      }
+    } else if (op == yield_ && arity == 1) {
+      if (inside_try)
+        fail("Cannot yield inside try", form);
+      const auto value = operand(arguments[0]);
+      emit(Op::YIELD, value);
+      if (value != target)
+        emit(Op::MOVE, target, value);
+    } else if (op) {
+      const auto bound = body.calls.find(form);
+      const auto function =
+          bound == body.calls.end() ? vm.find(op, arity) : bound->second;
+      if (function == no_body)
+        fail("No body for a function taking " + to_string(arity) +
+                 " arguments",
+             form);
+      if (function == overloaded)
+        fail("More than one function taking " + to_string(arity) +
+                 " arguments",
+             form);
+      if (vm.functions[function].generator)
+        fail("Generators are started from outside", form);
+      const auto first = next;
+      for (uint32_t i = 0; i < arity; ++i)
+        lower(arguments[i], temporary());
+      emit(Op::CALL, target, function, first);
+    } else
+      fail("Cannot lower", form);
+  }
+
+  /**
+   * The arguments of a clause from first up to last, for their last value,
+   * or 0 if there are none.
+   */
+  void sequence(const Instantiation &clause, uint32_t first, uint32_t target,
+                uint32_t last = UINT32_MAX) {
+    last = min(last, clause.arity);
+    if (first == last)
+      emit(Op::LOAD, target, constant(0));
+    for (uint32_t i = first; i < last; ++i)
+      lower(clause.arguments[i], target);
+  }
+
+  const VirtualMachine &vm;
+  const Body &body;
+  Code &code;
+  unordered_map<Atom, uint32_t> locals;
+  unordered_map<int64_t, uint32_t> constants;
+  uint32_t next = 0, first_temporary = 0;
+  uint32_t inside_try = 0; // Tries enclosing the form being lowered
+
+  static inline const Atom assign = intern("="), add = intern("+"),
+                           subtract = intern("-"), multiply = intern("*"),
+                           divide = intern("/"), modulo = intern("%"),
+                           less = intern("<"), greater = intern(">"),
+                           less_equal = intern("<="),
+                           greater_equal = intern(">="),
+                           equal = intern("=="), not_equal = intern("!="),
+                           negate = intern("!"), conjoin = intern("&&"),
+                           disjoin = intern("||"), if_ = intern("if"),
+                           while_ = intern("while"), do_ = intern("do"),
+                           return_ = intern("return"),
+                           yield_ = intern("yield"), yes = intern("true"),
+                           no = intern("false"), switch_ = intern("switch"),
+                           case_ = intern("case"),
+                           default_ = intern("default"), for_ = intern("for"),
+                           throw_ = intern("throw"), try_ = intern("try"),
+                           catch_ = intern("catch");
+};
+
+optional<int64_t> VirtualMachine::number(Atom atom) {
+  const auto text = spelling(atom);
+  const auto value = Rational::parse(text);
+  if (!value)
+    return {};
+  const auto limit = static_cast<uint64_t>(numeric_limits<int64_t>::max() +
+                                           uint64_t{value->negative});
+  if (!value->is_integer() || !value->numerator.is_small() ||
+      value->numerator.value() > limit)
+    throw out_of_range{"Not a 64-bit integer: " + string{text}};
+  const auto magnitude = value->numerator.value();
+  return value->negative ? static_cast<int64_t>(0 - magnitude)
+                         : static_cast<int64_t>(magnitude);
+}
+
+VirtualMachine::VirtualMachine(vector<Body> bodies)
+    : bodies(move(bodies)), stack(new int64_t[max_registers]) {
+  static const auto yield = intern("yield");
+  const auto &all = this->bodies;
+  functions.resize(all.size());
+  for (size_t i = 0; i < all.size(); ++i) {
+    auto &code = functions[i];
+    code.name = all[i].name;
+    code.parameters = all[i].parameters.size();
+    code.generator = any_of(
+        begin(all[i].forms), end(all[i].forms),
+        [](Reification form) { return contains(form, yield); });
+    if (auto [entry, added] =
+            by_signature.emplace(signature(code.name, code.parameters), i);
+        !added)
+      entry->second = overloaded;
+  }
+  frames.reserve(max_frames);
+  tries.reserve(max_frames);
+}
+
+bool VirtualMachine::add_class(Atom name, const vector<Refinement> &bases) {
+  if (auto type = scalar(bases)) {
+    machine_types[name] = *type;
+    return true;
+  }
+  return false;
+}
+
+/**
+ * Lowers function and every body it may call that is not lowered yet. If a
+ * form cannot be lowered, none of them is, so no call is left to a body
+ * without code.
+ */
+void VirtualMachine::lower(uint32_t function) {
+  vector<uint32_t> pending{function}, done;
+  try {
+    while (!pending.empty()) {
+      auto &code = functions[pending.back()];
+      const auto &body = bodies[pending.back()];
+      pending.pop_back();
+      if (code.lowered)
+        continue;
+      code.lowered = true;
+      done.push_back(&code - functions.data());
+      Lowering{*this, body, code};
+      for (auto &instruction : code.instructions)
+        if (instruction.op == Op::CALL && !functions[instruction.b].lowered)
+          pending.push_back(instruction.b);
+    }
+  } catch (...) {
+    for (auto i : done) {
+      auto &code = functions[i];
+      code.registers = 0;
+      code.lowered = false;
+      code.instructions.clear();
+      code.constants.clear();
+    }
+    throw;
+  }
+  if (!done.empty())
+    threaded = false;
+}
+
+/**
+ * The body of that name and arity, no_body if none, or overloaded.
+ */
+uint32_t VirtualMachine::find(Atom name, size_t arity) const {
+  auto function = by_signature.find(signature(name, arity));
+  return function == by_signature.end() ? no_body : function->second;
+}
+
+/**
+ * The one body a run may start from.
+ */
+uint32_t VirtualMachine::find_entry(Atom name, size_t arity) const {
+  const auto function = find(name, arity);
+  if (function == no_body || function == overloaded)
+    throw invalid_argument{
+        string{function == no_body ? "No function " : "More than one "} +
+        string{spelling(name)} + " taking " + to_string(arity) +
+        " arguments"};
+  return function;
+}
+
+bool VirtualMachine::is_generator(Atom name, size_t arity) const {
+  return functions[find_entry(name, arity)].generator;
+}
+
+size_t VirtualMachine::size() const {
+  size_t instructions = 0;
+  for (auto &code : functions)
+    instructions += code.instructions.size();
+  return instructions;
+}
+
+int64_t VirtualMachine::call(Atom name, const vector<int64_t> &arguments) {
+  const auto function = find_entry(name, arguments.size());
+  lower(function);
+  const auto &code = functions[function];
+  if (code.generator)
+    throw invalid_argument{string{spelling(name)} + " is a generator"};
+  if (top + code.registers > max_registers)
+    throw length_error{"Call stack overflow"};
+
+  auto registers = stack.get() + top;
+  copy(begin(arguments), end(arguments), registers);
+  top += code.registers;
+  uint32_t ip = 0;
+  bool yielded;
+  try {
+    auto value = run(function, registers, ip, yielded);
+    top -= code.registers;
+    return value;
+  } catch (...) {
+    top -= code.registers;
+    throw;
+  }
+}
+
+VirtualMachine::Generator
+VirtualMachine::start(Atom name, const vector<int64_t> &arguments) {
+  const auto function = find_entry(name, arguments.size());
+  lower(function);
+  Generator generator{*this, function};
+  generator.registers.resize(max(functions[function].registers,
+                                 functions[function].parameters));
+  copy(begin(arguments), end(arguments), begin(generator.registers));
+  return generator;
+}
+
+optional<int64_t> VirtualMachine::Generator::resume() {
+  if (done)
+    return {};
+  bool yielded;
+  auto value = vm.run(function, registers.data(), ip, yielded);
+  if (yielded)
+    return value;
+  done = true;
+  returned = value;
+  return {};
+}
+
+/**
+ * Direct threading: each instruction holds the address of its handler,
+ * which ends by jumping straight to the next instruction's handler, so
+ * there is no central switch. Labels as values are a GNU extension that
+ * both supported compilers have.
+ */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+int64_t VirtualMachine::run(uint32_t function, int64_t *registers,
+                            uint32_t &resume, bool &yielded) {
+  static const void *const handlers[] = {
+      &&op_move, &&op_load,  &&op_add,   &&op_sub,  &&op_mul, &&op_div,
+      &&op_mod,  &&op_less,  &&op_equal, &&op_not,  &&op_jump,
+      &&op_ifnot, &&op_if,   &&op_call,  &&op_return, &&op_yield,
+      &&op_try,   &&op_untry, &&op_throw, &&op_narrow};
+  if (!threaded) {
+    for (auto &code : functions)
+      for (auto &instruction : code.instructions)
+        instruction.target = handlers[static_cast<int>(instruction.op)];
+    threaded = true;
+  }
+
+  /**
+   * Frames pushed by calls, and tries, are dropped if an exception
+   * leaves mid-call.
+   */
+  struct Unwind {
+    VirtualMachine &vm;
+    size_t frames, tries, top;
+    ~Unwind() {
+      vm.frames.resize(frames);
+      vm.tries.resize(tries);
+      vm.top = top;
+    }
+  } unwind{*this, frames.size(), tries.size(), top};
+
+  const auto base = frames.size(), try_base = tries.size();
+  const Code *code = &functions[function];
+  const Instruction *ip = code->instructions.data() + resume;
+  int64_t *r = registers;
+  yielded = false;
+
+#define DISPATCH() goto *ip->target
+#define NEXT()                                                                 \
+  do {                                                                         \
+    ++ip;                                                                      \
+    DISPATCH();                                                                \
+  } while (0)
+#define WRAP(x) static_cast<int64_t>(static_cast<uint64_t>(x))
+
+  DISPATCH();
+op_move:
+  r[ip->a] = r[ip->b];
+  NEXT();
+op_load:
+  r[ip->a] = code->constants[ip->b];
+  NEXT();
+op_add:
+  r[ip->a] = WRAP(static_cast<uint64_t>(r[ip->b]) + r[ip->c]);
+  NEXT();
+op_sub:
+  r[ip->a] = WRAP(static_cast<uint64_t>(r[ip->b]) - r[ip->c]);
+  NEXT();
+op_mul:
+  r[ip->a] = WRAP(static_cast<uint64_t>(r[ip->b]) * r[ip->c]);
+  NEXT();
+op_div:
+op_mod:
+  if (!r[ip->c])
+    throw runtime_error{"Division by zero"};
+  if (r[ip->c] == -1)
+    r[ip->a] = ip->op == Op::DIV ? WRAP(0 - static_cast<uint64_t>(r[ip->b]))
+                                 : 0;
+  else
+    r[ip->a] = ip->op == Op::DIV ? r[ip->b] / r[ip->c] : r[ip->b] % r[ip->c];
+  NEXT();
+op_less:
+  r[ip->a] = r[ip->b] < r[ip->c];
+  NEXT();
+op_equal:
+  r[ip->a] = r[ip->b] == r[ip->c];
+  NEXT();
+op_not:
+  r[ip->a] = !r[ip->b];
+  NEXT();
+op_jump:
+  ip = code->instructions.data() + ip->a;
+  DISPATCH();
+op_ifnot:
+  ip = r[ip->a] ? ip + 1 : code->instructions.data() + ip->b;
+  DISPATCH();
+op_if:
+  ip = r[ip->a] ? code->instructions.data() + ip->b : ip + 1;
+  DISPATCH();
+op_call : {
+  const auto &callee = functions[ip->b];
+  if (frames.size() == max_frames || top + callee.registers > max_registers)
+    throw length_error{"Call stack overflow"};
+  frames.push_back({code, ip + 1, r, r + ip->a});
+  const auto arguments = r + ip->c;
+  r = stack.get() + top;
+  top += callee.registers;
+  copy(arguments, arguments + callee.parameters, r);
+  code = &callee;
+  ip = callee.instructions.data();
+  DISPATCH();
+}
+op_return : {
+  const auto value = r[ip->a];
+  while (tries.size() > try_base &&
+         tries.back().frames == frames.size())
+    tries.pop_back();
+  if (frames.size() == base) {
+    resume = 0;
+    return value;
+  }
+  top -= code->registers;
+  const auto frame = frames.back();
+  frames.pop_back();
+  code = frame.code;
+  ip = frame.ip;
+  r = frame.registers;
+  *frame.result = value;
+  DISPATCH();
+}
+op_yield:
+  resume = ip + 1 - code->instructions.data();
+  yielded = true;
+  return r[ip->a];
+op_try:
+  if (tries.size() == max_frames)
+    throw length_error{"Too many nested tries"};
+  tries.push_back({code, code->instructions.data() + ip->b, r, ip->a,
+                      frames.size(), top});
+  NEXT();
+op_untry:
+  tries.pop_back();
+  NEXT();
+op_throw : {
+  const auto value = r[ip->a];
+  if (tries.size() == try_base)
+    throw runtime_error{"Uncaught throw: " + to_string(value)};
+  const auto handler = tries.back();
+  tries.pop_back();
+  frames.resize(handler.frames);
+  top = handler.top;
+  code = handler.code;
+  ip = handler.ip;
+  r = handler.registers;
+  r[handler.target] = value;
+  DISPATCH();
+}
+op_narrow:
+  r[ip->a] = narrow(r[ip->a], static_cast<Scalar::Kind>(ip->b), ip->c);
+  NEXT();
+
+#undef WRAP
+#undef NEXT
+#undef DISPATCH
+}
+#pragma GCC diagnostic pop
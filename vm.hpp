@@ -0,0 +1,210 @@
+#pragma once
+
+#include "layout.hpp"
+#include "reification.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace tonal {
+using namespace std;
+
+/**
+ * Function bodies lowered to register bytecode. Values are 64-bit integers,
+ * with booleans as 0 and 1, which covers the machine types of lang.decl.
+ * A parameter naming a class stored as a Scalar is narrowed to it on entry,
+ * as converting to the C++ type of that Scalar would, and widened back
+ * wherever it is used.
+ *
+ * A body is a list of forms:
+ *   name, number, true, false
+ *   (= name value)               Assigns a local, declaring it if new
+ *   (+ - * / % < == ! && || ...) Arithmetic, comparison and logic
+ *   (if condition then else)     else may be left out
+ *   (switch value clauses...)    Each (case label forms...), compared in
+ *                                order, then at most one (default forms...)
+ *   (while condition forms...)
+ *   (for initial condition step forms...)
+ *   (do forms...)                The value of the last form
+ *   (return value)
+ *   (yield value)                Makes the function a generator
+ *   (throw value)                To the innermost try, across calls
+ *   (try forms... (catch name forms...))
+ *                                Assigns what was thrown to name
+ *   (function arguments...)      A call, to the body the file bound it to,
+ *                                else to the one body of that name and
+ *                                arity
+ */
+class VirtualMachine {
+public:
+  struct Body {
+    Atom name;
+    vector<Atom> parameters;
+    vector<Reification> forms;
+    vector<Atom> constraints; // Of each parameter, or 0
+
+    /**
+     * The body each call binds to, by its form, or no_body for a function
+     * declared without one.
+     */
+    unordered_map<Reification, uint32_t> calls;
+  };
+
+  static constexpr uint32_t no_body = UINT32_MAX;
+
+  /**
+   * Lowers nothing yet: a body is lowered the first time a run may reach
+   * it, so one the entry never calls costs nothing and may use forms the
+   * machine does not have.
+   */
+  explicit VirtualMachine(vector<Body> bodies);
+
+  /**
+   * Narrows parameters naming the class if one of its bases names a
+   * machine type. Returns whether it did.
+   */
+  bool add_class(Atom name, const vector<Refinement> &bases);
+
+  /**
+   * Runs a function to its return, lowering it and what it calls first.
+   * Throws invalid_argument if there is no such function, more than one, it
+   * is a generator, or a form on the way cannot be lowered.
+   */
+  int64_t call(Atom name, const vector<int64_t> &arguments);
+
+  /**
+   * A suspended run of a generator. Its registers are its own, so resuming
+   * does not allocate; calls it makes run on the machine's stack.
+   */
+  class Generator {
+  public:
+    /**
+     * The next yielded value, or none once the function returns.
+     */
+    optional<int64_t> resume();
+
+    /**
+     * What the function returned, once it has.
+     */
+    int64_t result() const { return returned; }
+
+  private:
+    friend class VirtualMachine;
+    Generator(VirtualMachine &vm, uint32_t function)
+        : vm(vm), function(function) {}
+
+    VirtualMachine &vm;
+    uint32_t function;
+    uint32_t ip = 0;
+    bool done = false;
+    int64_t returned = 0;
+    vector<int64_t> registers;
+  };
+
+  Generator start(Atom name, const vector<int64_t> &arguments);
+
+  bool is_generator(Atom name, size_t arity) const;
+
+  /**
+   * The value of a number atom, or none if the atom is not a number. Throws
+   * out_of_range for a number that is not a 64-bit integer.
+   */
+  static optional<int64_t> number(Atom atom);
+
+  /**
+   * Instructions lowered so far, for reporting.
+   */
+  size_t size() const;
+
+private:
+  enum class Op : uint8_t {
+    MOVE,   // a = b
+    LOAD,   // a = constants[b]
+    ADD,    // a = b + c
+    SUB,    // a = b - c
+    MUL,    // a = b * c
+    DIV,    // a = b / c
+    MOD,    // a = b % c
+    LESS,   // a = b < c
+    EQUAL,  // a = b == c
+    NOT,    // a = !b
+    JUMP,   // Go to a
+    IFNOT,  // Go to b if a is 0
+    IF,     // Go to b if a is not 0
+    CALL,   // a = functions[b] of the registers from c up
+    RETURN, // Return a
+    YIELD,  // Suspend with a
+    TRY,    // Until UNTRY, a throw assigns a and goes to b
+    UNTRY,  // Drop the innermost TRY
+    THROW,  // Throw a
+    NARROW, // a = a as a Scalar of kind b and c bits
+  };
+
+  /**
+   * target is the address of the handler for op, filled in the first time
+   * the code runs.
+   */
+  struct Instruction {
+    const void *target = nullptr;
+    Op op;
+    uint32_t a = 0, b = 0, c = 0;
+  };
+
+  struct Code {
+    Atom name;
+    uint32_t parameters = 0;
+    uint32_t registers = 0;
+    bool generator = false;
+    bool lowered = false;
+    vector<Instruction> instructions;
+    vector<int64_t> constants;
+  };
+
+  /**
+   * A call in progress. Frames and their registers are carved from stacks
+   * reserved when the machine is made, so calls do not allocate.
+   */
+  struct Frame {
+    const Code *code;
+    const Instruction *ip;
+    int64_t *registers;
+    int64_t *result;
+  };
+
+  /**
+   * A TRY in progress, with what to unwind the stacks to on a throw.
+   */
+  struct Handler {
+    const Code *code;
+    const Instruction *ip;
+    int64_t *registers;
+    uint32_t target;
+    size_t frames, top;
+  };
+
+  class Lowering;
+
+  static constexpr uint32_t overloaded = UINT32_MAX - 1;
+
+  uint32_t find(Atom name, size_t arity) const;
+  uint32_t find_entry(Atom name, size_t arity) const;
+  void lower(uint32_t function);
+  int64_t run(uint32_t function, int64_t *registers, uint32_t &ip,
+              bool &yielded);
+
+  static constexpr size_t max_frames = 1 << 16, max_registers = 1 << 22;
+
+  vector<Body> bodies;
+  unordered_map<Atom, Scalar> machine_types;
+  vector<Code> functions;
+  unordered_map<uint64_t, uint32_t> by_signature; // Name and arity
+  vector<Frame> frames;
+  vector<Handler> tries;
+  unique_ptr<int64_t[]> stack;
+  size_t top = 0; // First free register on the stack
+  bool threaded = false;
+};
+} // namespace tonal